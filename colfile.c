@@ -0,0 +1,265 @@
+/* Minimal reader and writer for raw column files.
+
+   The input side maps the file read-only and hands back pointers into
+   the mapping, so column data are never copied or parsed.
+
+   Format (all integers are UINT32 in the byte order of the machine
+   that wrote the file - a reader on a machine of the other byte order
+   rejects the file rather than byte-swapping, which would need a copy):
+
+   Offset  Size  
+   0       8     Magic "NRMCOL1\0"
+   8       4     Byte order marker 0x01020304
+   12      4     Number of columns
+   16      8     Number of rows (low word, then high word)
+   24      48    One descriptor per column:
+                    32 bytes  name, NUL-padded
+                     8 bytes  type, NUL-padded: f8 (double), f4 (float),
+                              u4 (UINT32) or u1 (unsigned char)
+                     8 bytes  offset of the column data from the start
+                              of the file (low word, then high word)
+   ...           Column data, each column starting on an 8-byte
+                 boundary: nrows values packed with no padding
+
+   All columns have the same number of rows.
+
+   WriteColFile() writes a complete file from columns in memory. To
+   stream a file too big for memory, call WriteColHeader(), then write
+   each column's values in turn, calling WriteColPadding() with the
+   current file offset before each column after the first (the header
+   already pads to the first column).
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "colfile.h"
+
+static UINT32 GetUint32(const unsigned char *buffer);
+static unsigned long GetUlong(const unsigned char *buffer);
+static int PutUint32(FILE *fp, UINT32 value);
+static int PutUlong(FILE *fp, unsigned long value);
+
+
+static UINT32 GetUint32(const unsigned char *buffer)
+{
+   UINT32 value;
+   memcpy(&value, buffer, sizeof(UINT32));
+   return value;
+}
+
+static unsigned long GetUlong(const unsigned char *buffer)
+{
+   unsigned long lo, hi;
+
+   lo = (unsigned long)GetUint32(buffer);
+   hi = (unsigned long)GetUint32(buffer+4);
+   if(hi && (sizeof(unsigned long) <= 4))
+      return 0UL;                  /* Too big - caller's checks fail    */
+   return ((hi << 16) << 16) | lo;
+}
+
+static int PutUint32(FILE *fp, UINT32 value)
+{
+   return fwrite(&value, sizeof(UINT32), 1, fp) == 1;
+}
+
+static int PutUlong(FILE *fp, unsigned long value)
+{
+   return PutUint32(fp, (UINT32)(value & 0xFFFFFFFFUL)) &&
+          PutUint32(fp, (UINT32)((value >> 16) >> 16));
+}
+
+
+int ColTypeSize(char *type)
+{
+   if(!strcmp(type, "f8")) return sizeof(double);
+   if(!strcmp(type, "f4")) return sizeof(float);
+   if(!strcmp(type, "u4")) return sizeof(UINT32);
+   if(!strcmp(type, "u1")) return 1;
+   return 0;
+}
+
+
+COLFILE *OpenColFile(char *filename)
+{
+   COLFILE             *cf;
+   COLUMN              *col;
+   struct stat         st;
+   const unsigned char *base, *desc;
+   unsigned long       size;
+   int                 fd, i, width;
+
+   if(sizeof(UINT32) != 4)
+      return NULL;
+
+   if((fd = open(filename, O_RDONLY)) < 0)
+      return NULL;
+   if((fstat(fd, &st) < 0) || (st.st_size < COL_HEADERSIZE))
+   {
+      close(fd);
+      return NULL;
+   }
+
+   if((cf = (COLFILE *)malloc(sizeof(COLFILE))) == NULL)
+   {
+      close(fd);
+      return NULL;
+   }
+   cf->cols = NULL;
+   cf->size = (unsigned long)st.st_size;
+   cf->map  = mmap(NULL, (size_t)cf->size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(cf->map == MAP_FAILED)
+   {
+      free(cf);
+      return NULL;
+   }
+   base = (const unsigned char *)cf->map;
+   size = cf->size;
+
+   if(memcmp(base, COL_MAGIC, 8) || (GetUint32(base+8) != COL_BYTEORDER))
+   {
+      CloseColFile(cf);
+      return NULL;
+   }
+   cf->ncols = (int)GetUint32(base+12);
+   cf->nrows = GetUlong(base+16);
+   if((cf->ncols <= 0) || 
+      (COL_HEADERSIZE + (unsigned long)cf->ncols * COL_DESCSIZE > size) ||
+      ((cf->cols = (COLUMN *)malloc(cf->ncols * sizeof(COLUMN))) == NULL))
+   {
+      CloseColFile(cf);
+      return NULL;
+   }
+
+   for(i=0; i<cf->ncols; i++)
+   {
+      col  = &(cf->cols[i]);
+      desc = base + COL_HEADERSIZE + i * COL_DESCSIZE;
+      memcpy(col->name, desc, COL_NAMELEN);
+      memcpy(col->type, desc+COL_NAMELEN, COL_TYPELEN);
+      col->name[COL_NAMELEN-1] = col->type[COL_TYPELEN-1] = '\0';
+      col->offset = GetUlong(desc+COL_NAMELEN+COL_TYPELEN);
+
+      /* Reject unknown types, misaligned data and columns that run off
+         the end of the file (checking without overflow)
+      */
+      if(((width = ColTypeSize(col->type)) == 0) ||
+         (col->offset % COL_ALIGN) ||
+         (col->offset > size) ||
+         (cf->nrows > (size - col->offset) / width))
+      {
+         CloseColFile(cf);
+         return NULL;
+      }
+      col->data = base + col->offset;
+   }
+
+   return cf;
+}
+
+
+void CloseColFile(COLFILE *cf)
+{
+   if(cf == NULL)
+      return;
+   if(cf->cols != NULL)
+      free(cf->cols);
+   munmap(cf->map, (size_t)cf->size);
+   free(cf);
+}
+
+
+COLUMN *FindColumn(COLFILE *cf, char *name)
+{
+   int i;
+   for(i=0; i<cf->ncols; i++)
+   {
+      if(!strcmp(cf->cols[i].name, name))
+         return &(cf->cols[i]);
+   }
+   return NULL;
+}
+
+
+int WriteColHeader(FILE *fp, int ncols, char **names, char **types,
+                   unsigned long nrows)
+{
+   char          name[COL_NAMELEN],
+                 type[COL_TYPELEN];
+   unsigned long offset;
+   int           i, width;
+
+   if((sizeof(UINT32) != 4) ||
+      (fwrite(COL_MAGIC, 1, 8, fp) != 8) ||
+      !PutUint32(fp, COL_BYTEORDER) ||
+      !PutUint32(fp, (UINT32)ncols) ||
+      !PutUlong(fp, nrows))
+      return 0;
+
+   offset = COL_HEADERSIZE + (unsigned long)ncols * COL_DESCSIZE;
+   for(i=0; i<ncols; i++)
+   {
+      if(((width = ColTypeSize(types[i])) == 0) ||
+         (strlen(names[i]) >= COL_NAMELEN))
+         return 0;
+      memset(name, 0, COL_NAMELEN);
+      memset(type, 0, COL_TYPELEN);
+      strcpy(name, names[i]);
+      strcpy(type, types[i]);
+
+      offset = (offset + COL_ALIGN - 1) / COL_ALIGN * COL_ALIGN;
+      if((fwrite(name, 1, COL_NAMELEN, fp) != COL_NAMELEN) ||
+         (fwrite(type, 1, COL_TYPELEN, fp) != COL_TYPELEN) ||
+         !PutUlong(fp, offset))
+         return 0;
+      offset += nrows * width;
+   }
+
+   /* Pad to the start of the first column                             */
+   offset = COL_HEADERSIZE + (unsigned long)ncols * COL_DESCSIZE;
+   return WriteColPadding(fp, offset) != 0;
+}
+
+
+unsigned long WriteColPadding(FILE *fp, unsigned long offset)
+{
+   static char   pad[COL_ALIGN];
+   unsigned long npad = (COL_ALIGN - offset % COL_ALIGN) % COL_ALIGN;
+
+   if(npad && (fwrite(pad, 1, npad, fp) != npad))
+      return 0;
+   return offset + npad;
+}
+
+
+int WriteColFile(FILE *fp, int ncols, char **names, char **types,
+                 void **data, unsigned long nrows)
+{
+   unsigned long offset;
+   int           i, width;
+
+   if(!WriteColHeader(fp, ncols, names, types, nrows))
+      return 0;
+
+   offset = COL_HEADERSIZE + (unsigned long)ncols * COL_DESCSIZE;
+   for(i=0; i<ncols; i++)
+   {
+      width = ColTypeSize(types[i]);
+      if((offset = WriteColPadding(fp, offset)) == 0)
+         return 0;
+      if(nrows && (fwrite(data[i], width, nrows, fp) != nrows))
+         return 0;
+      offset += nrows * width;
+   }
+
+   return fflush(fp) == 0;
+}
@@ -0,0 +1,42 @@
+/* Raw column file format - see colfile.c
+ */
+#ifndef _COLFILE_H
+#define _COLFILE_H
+
+#define COL_MAGIC      "NRMCOL1"
+#define COL_BYTEORDER  0x01020304U
+#define COL_HEADERSIZE 24
+#define COL_DESCSIZE   48
+#define COL_NAMELEN    32
+#define COL_TYPELEN    8
+#define COL_ALIGN      8
+
+typedef unsigned int UINT32;
+
+typedef struct
+{
+   char          name[COL_NAMELEN],
+                 type[COL_TYPELEN];
+   unsigned long offset;
+   const void    *data;       /* Points into the mapping - not a copy   */
+}  COLUMN;
+
+typedef struct
+{
+   void          *map;
+   unsigned long size,
+                 nrows;
+   int           ncols;
+   COLUMN        *cols;
+}  COLFILE;
+
+COLFILE *OpenColFile(char *filename);
+void    CloseColFile(COLFILE *cf);
+COLUMN  *FindColumn(COLFILE *cf, char *name);
+int     ColTypeSize(char *type);
+int     WriteColFile(FILE *fp, int ncols, char **names, char **types,
+                     void **data, unsigned long nrows);
+int     WriteColHeader(FILE *fp, int ncols, char **names, char **types,
+                       unsigned long nrows);
+unsigned long WriteColPadding(FILE *fp, unsigned long offset);
+#endif
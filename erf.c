@@ -12,6 +12,7 @@
 
 void NUMERICS_ERROR(const char *func, const char *msg);
 double erff(double x);
+double erfcc(double x);
 double gammp(double a, double x);
 void gser(double *gamser, double a, double x, double *gln);
 double gammln(double xx);
@@ -30,6 +31,23 @@ double erff(double x)
    return x < 0.0 ? -gammp(.5, x * x) : gammp(.5, x * x);
 }
 
+/* Complementary error function by Chebyshev fitting. Fractional error
+   is below 1.2e-7 everywhere, with no iteration, so it is cheap enough
+   to call once per record in the multivariate batch kernel.
+ */
+double erfcc(double x)
+{
+   double t, z, ans;
+
+   z = fabs(x);
+   t = 1.0 / (1.0 + 0.5 * z);
+   ans = t * exp(-z*z - 1.26551223 + t*(1.00002368 + t*(0.37409196 +
+         t*(0.09678418 + t*(-0.18628806 + t*(0.27886807 +
+         t*(-1.13520398 + t*(1.48851587 + t*(-0.82215223 +
+         t*0.17087277)))))))));
+   return x >= 0.0 ? ans : 2.0 - ans;
+}
+
 double gammp(double a, double x)
 {
    double gamser, gammcf, gln;
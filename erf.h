@@ -1,5 +1,6 @@
 double erff(double x);
 double erff(double x);
+double erfcc(double x);
 double gammp(double a, double x);
 void   gser(double *gamser, double a, double x, double *gln);
 double gammln(double xx);
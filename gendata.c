@@ -3,8 +3,8 @@
    Program:    normalize
    File:       normalize.c
    
-   Version:    V1.0
-   Date:       24.07.09
+   Version:    V1.1
+   Date:       19.10.26
    Function:   Generate a normal distribution by selecting from a dataset
    
    Copyright:  (c) UCL / Dr. Andrew C. R. Martin 2009
@@ -36,25 +36,34 @@
 
    Description:
    ============
+   Generates MAXDATA uniformly distributed test values in the range
+   0..MAXVAL. By default these are written as text lines; with -r they
+   are written as a raw column file (see colfile.c) with an f8 'value'
+   column and a u4 'id' column.
 
 **************************************************************************
 
    Usage:
    ======
+   gendata [-r] > out.dat
 
 **************************************************************************
 
    Revision History:
    =================
+   V1.0  24.07.09 Original
+   V1.1  19.10.26 Added -r for column file output
 
 *************************************************************************/
 /* Includes
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include "bioplib/MathType.h"
+#include "colfile.h"
 
 /************************************************************************/
 /* Defines and macros
@@ -71,6 +80,7 @@
 */
 int main(int argc, char **argv);
 REAL RandomNumber(REAL maxval);
+int WriteColumns(FILE *out);
 
 
 /************************************************************************/
@@ -81,12 +91,23 @@ REAL RandomNumber(REAL maxval);
    Returns:   
 
    24.07.09  Original   By: ACRM
+   19.10.26  Added -r   By: agent
 */
 int main(int argc, char **argv)
 {
    int i;
 
    srand((unsigned int)time(NULL));
+
+   if((argc == 2) && !strcmp(argv[1], "-r"))
+   {
+      if(!WriteColumns(stdout))
+      {
+         fprintf(stderr,"Error: Unable to write column file\n");
+         return(1);
+      }
+      return(0);
+   }
    
    for(i=0; i<MAXDATA; i++)
    {
@@ -110,3 +131,43 @@ REAL RandomNumber(REAL maxval)
 {
    return(maxval * rand()/(REAL)RAND_MAX);
 }
+
+
+/************************************************************************/
+/*>int WriteColumns(FILE *out)
+   ---------------------------
+   Input:     FILE   *out     Output file
+   Returns:   int             Success
+
+   Writes the test data as a raw column file
+
+   19.10.26  Original   By: agent
+*/
+int WriteColumns(FILE *out)
+{
+   double *value;
+   UINT32 *id;
+   char   *names[2],
+          *types[2];
+   void   *data[2];
+   int    i, ok;
+
+   value = (double *)malloc(MAXDATA * sizeof(double));
+   id    = (UINT32 *)malloc(MAXDATA * sizeof(UINT32));
+   if((value == NULL) || (id == NULL))
+      return(0);
+
+   for(i=0; i<MAXDATA; i++)
+   {
+      value[i] = RandomNumber((REAL)MAXVAL);
+      id[i]    = (UINT32)i;
+   }
+
+   names[0] = "value";  types[0] = "f8";  data[0] = (void *)value;
+   names[1] = "id";     types[1] = "u4";  data[1] = (void *)id;
+   ok = WriteColFile(out, 2, names, types, data, (unsigned long)MAXDATA);
+
+   free(value);
+   free(id);
+   return(ok);
+}
@@ -3,8 +3,8 @@
    Program:    normalize
    File:       normalize.c
    
-   Version:    V1.0
-   Date:       24.07.09
+   Version:    V1.7
+   Date:       19.10.26
    Function:   Generate a normal distribution by selecting from a dataset
    
    Copyright:  (c) UCL / Dr. Andrew C. R. Martin 2009
@@ -65,15 +65,162 @@
    and checked against
       http://www.stat.wvu.edu/SRS/Modules/Normal/males.html
 
+**************************************************************************
+
+   Grouped mode:
+   -------------
+   With -k, each record carries a key (e.g. a sample ID) and is sampled
+   against the mean and SD for that key rather than the global target.
+   Per-key targets are read from a table (-g) of lines of the form
+      key mean sd
+   Keys not in the table fall back to the mean and SD given on the
+   command line. Keys are interned into an open-addressing (linear
+   probing) hash table as the input is read, so each record costs one
+   lookup and all groups are sampled in a single pass. Output is either
+   interleaved in input order or, with -p, written to one file per key
+   ('/' and '%' in a key are escaped as %2F and %25 in the filename).
+   Records with no key field are not written with -p; their number is
+   reported on stderr.
+
+   Follow mode:
+   ------------
+   With -f, the input is treated as an append-only file. A small text
+   checkpoint file records the byte offset reached, the random number
+   generator state and the quality statistics (see below). Each
+   run seeks to the saved offset, processes only the complete lines
+   added since, appends newly accepted lines to the output and rewrites
+   the checkpoint. Since exactly one random number is drawn per record,
+   in order, a series of follow runs gives the same output as one full
+   run with the same seed (-s). An incomplete last line (no newline yet)
+   is left for the next run.
+
+   The checkpoint also holds a hash of the start of the input and the
+   target mean, SD, -c, -k and a hash of the -g file. A run stops with
+   an error if the input is now shorter than the saved offset or starts
+   differently (i.e. it has been truncated, rotated or replaced), or if
+   the parameters differ, rather than silently mixing output.
+
+   Output is appended before the checkpoint is rewritten, so the length
+   of the output file is saved too. If a run fails between the two, the
+   next one cuts the output back to that length before carrying on (and
+   refuses to run if it is shorter). Output written to stdout can't be
+   recovered this way.
+
+   Multivariate mode:
+   ------------------
+   With -M, each record is a vector of d values taken from the columns
+   given with -c. A model file gives the target mean vector, $\mu$, and
+   covariance matrix, $\Sigma$. $|z|$ is replaced by the Mahalanobis
+   distance
+      D^2 = (x-\mu)^T \Sigma^{-1} (x-\mu)
+   and p by the probability of a value at least this far out, which is
+   the upper tail of the $\chi^2_d$ distribution:
+      p = Q(d/2, D^2/2)
+   For d=1 this is exactly the p used above.
+
+   $\Sigma$ is Cholesky factored once ($\Sigma = LL^T$) so that
+   $D^2 = |y|^2$ where $Ly = x-\mu$. Records are read in blocks of
+   BLOCKSIZE held as structure-of-arrays (one array per dimension) so
+   the forward substitution runs as simple loops over the block that the
+   compiler can vectorize. The $\chi^2$ tail uses the closed forms
+      Q = e^{-h} \sum_{k=0}^{d/2-1} h^k/k!                     (d even)
+      Q = erfc(\sqrt{h}) + 
+          e^{-h} \sum_{k=1}^{(d-1)/2} h^{k-1/2}/\Gamma(k+1/2)   (d odd)
+   with h = D^2/2, which need only one exp() and (for odd d) one
+   non-iterative erfc() per record.
+
+   Column file input:
+   ------------------
+   With -r, the input is a raw column file (format described in
+   colfile.c) rather than text. The file is memory mapped and the named
+   value column is read in place, so nothing is copied or parsed. The
+   output is a column file holding either a u1 column, 'selected', with
+   one 0/1 flag per input row or, with -i, a u4 column, 'index', of the
+   (zero-based) selected row numbers. One random number is drawn per
+   row so the selection matches a text run with the same seed.
+
+   Output quality:
+   ---------------
+   With -q, statistics of the accepted values are gathered as they are
+   selected (see stats.c) and reported on stderr: the achieved mean, SD
+   and skewness against the target, the acceptance rate and the
+   Kolmogorov-Smirnov distance from the target distribution. In grouped
+   mode there is one accumulator per group; these are reported
+   separately and merged for the overall KS distance. In multivariate
+   mode the moments are of $D^2$, whose target mean is d and SD
+   $\sqrt{2d}$. -Q sets a maximum KS distance above which normalize
+   exits with status 2 (after writing its output). In follow mode the
+   accumulators are saved in the checkpoint and carried on by the next
+   run, so the statistics cover the whole output, not just that run.
+
+   Bounded memory:
+   ---------------
+   By default text input is read into a linked list before sampling.
+   With -L (or --mem-limit) memory use is capped instead:
+   - Interleaved text output is streamed a record at a time.
+   - Per-group output (-p) collects accepted records in a buffer of
+     the given size. When it fills, the buffer is sorted by group and
+     written to a temporary file as one sequential run. At the end the
+     runs are merged, which visits each group once, in order, so each
+     group file is written in one go. Ties go to the earlier run, so
+     records stay in input order within a group. Runs are merged in
+     levels, as in an LSM tree: when MAXRUNS runs build up at one level
+     they are merged into a single run at the next. Each record is
+     therefore copied once per level, about log_MAXRUNS(input/limit)
+     times, and no more than MAXRUNS runs are open per level.
+   - Column files are processed in chunks. Flags are written as each
+     chunk is done; row numbers are spilled to a temporary file until
+     their count (needed for the header) is known.
+   The random numbers are drawn in the same order as without -L, so the
+   output is identical. Follow and multivariate modes always stream.
+
+   Replicates:
+   -----------
+   With -R K, K independent samples are drawn in one pass, for example
+   for bootstrap-style estimates of how much a statistic varies between
+   samples. Each record is parsed and its p calculated once. Each
+   replicate then has its own random number stream and the K random
+   numbers are drawn together in a branch-free loop over the states
+   (held as structure-of-arrays), so a replicate costs about one random
+   number and a compare per record.
+
+   Replicate 0 uses the xorshift32 stream of an ordinary run, so with
+   the same seed it is exactly the ordinary sample. The others use
+   xoshiro128** (period 2^128-1, 32-bit arithmetic only). They are
+   seeded from one base state by repeated jumps of 2^64 steps, so each
+   stream is a separate, non-overlapping stretch of the sequence rather
+   than a random starting point on a shared cycle.
+
+   Rather than K copies of the data, the output is a line per input
+   record giving its membership of the replicates as a bitset written
+   in hex (see ReplicateData()). With -x, each replicate's selected row
+   numbers are written to their own file instead. Replicate mode works
+   with grouped targets (-k, -g) and always streams.
+
 **************************************************************************
 
    Usage:
    ======
+   normalize [-c valcol] [-k keycol [-g groups.dat] [-p prefix]]
+             [-s seed] [-f checkpoint] mean sd [in.dat [out.dat]]
+   normalize -M model.dat [-c col,col,...] [-s seed] [in.dat [out.dat]]
+   normalize -r column [-i] [-s seed] mean sd in.col [out.col]
+   normalize -R nreps [-x prefix] [-c valcol] [-k keycol [-g groups.dat]]
+             [-s seed] mean sd [in.dat [out.dat]]
+   All modes also take [-L size] and, except -R, [-q] [-Q maxks]
 
 **************************************************************************
 
    Revision History:
    =================
+   V1.0  24.07.09 Original
+   V1.1  19.10.26 Added grouped mode (-k, -g, -p) and value column (-c)
+   V1.2  19.10.26 Added follow mode (-f) and seedable random numbers (-s)
+   V1.3  19.10.26 Added multivariate mode (-M)
+   V1.4  19.10.26 Added memory-mapped column file input (-r, -i)
+   V1.5  19.10.26 Added output quality statistics (-q, -Q)
+   V1.6  19.10.26 Added bounded memory mode (-L, --mem-limit)
+   V1.7  19.10.26 Added replicate mode (-R, -x)
 
 *************************************************************************/
 /* Includes
@@ -88,6 +235,8 @@
 #include "bioplib/macros.h"
 #include "bioplib/general.h"
 #include "erf.h"
+#include "colfile.h"
+#include "stats.h"
 
 /************************************************************************/
 /* Defines and macros
@@ -95,30 +244,197 @@
 #define MAXDATA 10000000
 #define MAXVAL  100
 #define MAXBUFF 512
+#define MINSLOTS 64     /* Initial number of hash slots (power of 2)    */
+#define MAXDIM   32     /* Maximum dimensions in multivariate mode      */
+#define MAXCOLS  (MAXBUFF/2) /* A line can't have more fields than this */
+#define BLOCKSIZE 256   /* Records per multivariate block               */
+#define MINMEMLIMIT 65536L /* Smallest -L accepted                      */
+#define MAXRUNS  64     /* Merge fan-in (runs per level) in -L mode     */
+#define MAXLEVELS 8     /* Run levels - allows MAXRUNS^MAXLEVELS spills */
+#define MAXREPS  1024   /* Maximum replicates with -R                   */
+#define MAXREPFILES 256 /* Maximum replicates with -x (one file each)   */
+#define CKPTHEAD 4096L  /* Bytes of input hashed to identify it in -f   */
+
+/* Rotate a 32-bit unsigned value left by k bits (0 < k < 32)           */
+#define ROTL32(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
+
+/* Results from CheckFollowInput()                                      */
+#define FOLLOW_OK      0
+#define FOLLOW_SHRUNK  1
+#define FOLLOW_CHANGED 2
+#define FOLLOW_ERROR   3
 
 typedef struct _reallist
 {
    struct _reallist *next;
    REAL value;
+   int  group;          /* Index into GROUPTABLE or -1 if ungrouped     */
    char data[MAXBUFF];
 }  REALLIST;
 
+typedef struct
+{
+   char     *key;
+   REAL     mean,
+            sd;
+   REALLIST *head,      /* Selected records for per-group output        */
+            *tail;
+   STATS    *stats;     /* Quality statistics (NULL unless -q)          */
+}  GROUP;
+
+typedef struct
+{
+   int   *slots;        /* Open-addressing slots: group index or -1     */
+   GROUP *groups;       /* Interned groups in order of first appearance */
+   int   nslots,        /* Always a power of 2                          */
+         ngroups,
+         maxgroups;
+}  GROUPTABLE;
+
+typedef struct
+{
+   long          offset;      /* Bytes of input consumed so far         */
+   unsigned long randState;   /* Random number generator state          */
+   STATS         stats;       /* Statistics of ungrouped records (the
+                                 groups' own are in the group table)    */
+   long          outLen;      /* Length of the output (-1 if stdout)    */
+   long          headLen;     /* Bytes at the start of the input that.. */
+   unsigned long headHash;    /* ..hash to this (identifies the file)   */
+   REAL          targetMean,  /* Parameters the output was built with   */
+                 targetSD;
+   int           valCol,
+                 keyCol;
+   unsigned long groupHash;   /* Hash of the -g file (0 if none)        */
+}  CHECKPOINT;
+
+typedef struct
+{
+   int  ndim,
+        cols[MAXDIM];           /* Input column for each dimension      */
+   REAL mean[MAXDIM],
+        chol[MAXDIM][MAXDIM],   /* Lower Cholesky factor of covariance  */
+        invDiag[MAXDIM];        /* 1/chol[i][i]                         */
+}  MVMODEL;
+
+typedef struct
+{
+   int  group,
+        len;
+   char *text;                  /* Not NUL terminated                   */
+}  RUNREC;
+
+typedef struct
+{
+   FILE *runs[MAXLEVELS][MAXRUNS]; /* Oldest first within a level; all
+                                      runs at a level are older than
+                                      those at the level below          */
+   int  nruns[MAXLEVELS];
+}  RUNSET;
+
+typedef struct
+{
+   FILE *fp;
+   int  group,                  /* -1 when the run is exhausted         */
+        len;
+   char text[MAXBUFF];
+}  RUNHEAD;
+
 /************************************************************************/
 /* Globals
 */
+unsigned long gRandState = 1UL;   /* xorshift32 state - never zero      */
 
 /************************************************************************/
 /* Prototypes
 */
 int main(int argc, char **argv);
-REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD);
-REALLIST *ReadData(FILE *fp);
+REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD,
+                        GROUPTABLE *groups, STATS *stats);
+REALLIST *ReadData(FILE *fp, int valCol, int keyCol, GROUPTABLE *groups,
+                   REAL targetMean, REAL targetSD);
 REAL CalcProbability(REAL z);
 void PrintData(FILE *out, REALLIST *newdata);
+BOOL PrintGroupData(char *prefix, REALLIST *newdata, GROUPTABLE *groups,
+                    long *nokey);
 REAL RandomNumber(REAL maxval);
+void SeedRandom(unsigned long seed);
+unsigned long ScrambleSeed(unsigned long seed);
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                  REAL *targetMean, REAL *targetSD);
+                  REAL *targetMean, REAL *targetSD, int *cols,
+                  int *ncols, int *keyCol, char *groupFile,
+                  char *groupPrefix, unsigned long *seed, BOOL *haveSeed,
+                  char *ckptFile, char *modelFile, char *rawColumn,
+                  BOOL *indexOut, BOOL *quality, REAL *maxKS,
+                  unsigned long *memLimit, int *nreps,
+                  char *repPrefix);
+BOOL ParseSize(char *string, unsigned long *size);
+BOOL ParseRecord(char *buffer, REALLIST *d, int valCol, int keyCol,
+                 GROUPTABLE *groups, REAL targetMean, REAL targetSD);
+BOOL SelectRecord(REALLIST *d, REAL targetMean, REAL targetSD,
+                  GROUPTABLE *groups);
+BOOL SelectValue(REAL value, REAL mean, REAL sd);
+void GetTarget(REALLIST *d, REAL targetMean, REAL targetSD,
+               GROUPTABLE *groups, REAL *mean, REAL *sd);
+BOOL AccumulateRecord(REALLIST *d, BOOL accepted, REAL targetMean,
+                      REAL targetSD, GROUPTABLE *groups, STATS *stats);
+int ReportQuality(FILE *fp, STATS *stats, GROUPTABLE *groups,
+                  REAL targetMean, REAL targetSD, REAL maxKS);
+void PrintStats(FILE *fp, char *label, STATS *stats, BOOL showMoments,
+                REAL targetMean, REAL targetSD);
+BOOL NormalizeColumn(FILE *out, COLUMN *col, unsigned long nrows,
+                     REAL targetMean, REAL targetSD, BOOL indexOut,
+                     STATS *stats, unsigned long memLimit);
+BOOL StreamData(FILE *in, FILE *out, int valCol, int keyCol,
+                GROUPTABLE *groups, REAL targetMean, REAL targetSD,
+                STATS *stats);
+BOOL StreamGroupData(FILE *in, char *prefix, int valCol, int keyCol,
+                     GROUPTABLE *groups, REAL targetMean, REAL targetSD,
+                     STATS *stats, unsigned long memLimit, long *nokey);
+int  CompareRunRecs(const void *a, const void *b);
+BOOL SpillRun(RUNREC *recs, int nrecs, RUNSET *runs);
+BOOL AddRun(RUNSET *runs, int level, FILE *fp);
+BOOL FinishRuns(RUNSET *runs, char *prefix, GROUPTABLE *groups);
+void CloseRuns(RUNSET *runs);
+BOOL MergeRuns(FILE **runs, int nruns, FILE *to, char *prefix,
+               GROUPTABLE *groups);
+BOOL ReadRunHead(RUNHEAD *head);
+BOOL GroupFilename(char *prefix, char *key, char *filename);
+BOOL FollowData(FILE *in, FILE *out, CHECKPOINT *ckpt, int valCol,
+                int keyCol, GROUPTABLE *groups, REAL targetMean,
+                REAL targetSD);
+BOOL ReadCheckpoint(char *filename, CHECKPOINT *ckpt, GROUPTABLE *groups,
+                    REAL targetMean, REAL targetSD, BOOL *found);
+BOOL WriteCheckpoint(char *filename, CHECKPOINT *ckpt,
+                     GROUPTABLE *groups);
+void WriteCkptStats(FILE *fp, STATS *stats);
+int  CheckFollowInput(FILE *in, CHECKPOINT *ckpt);
+int  CheckFollowOutput(char *filename, CHECKPOINT *ckpt);
+long FileLength(char *filename);
+BOOL TruncateFile(char *filename, long length);
+BOOL HashHead(FILE *in, long nbytes, unsigned long *hash);
+BOOL ReadModel(FILE *fp, MVMODEL *model);
+BOOL CholeskyDecompose(REAL cov[MAXDIM][MAXDIM], MVMODEL *model);
+BOOL NormalizeMultiData(FILE *in, FILE *out, MVMODEL *model,
+                        STATS *stats);
+void MahalanobisBlock(MVMODEL *model, REAL *block, REAL *d2, int n);
+void ChiSqTailBatch(int ndim, REAL *d2, REAL *p, int n);
 void Usage(void);
+char *GetField(char *buffer, int field, char *word, int maxlen);
+GROUPTABLE *CreateGroupTable(void);
+void FreeGroupTable(GROUPTABLE *table);
+unsigned long HashKey(char *key);
+int FindGroup(GROUPTABLE *table, char *key);
+int InternGroup(GROUPTABLE *table, char *key, REAL mean, REAL sd);
+BOOL GrowGroupTable(GROUPTABLE *table);
+BOOL ReadGroupTable(FILE *fp, GROUPTABLE *table);
+void SeedReplicates(UINT32 *states, int nreps, unsigned long seed);
+void StepXoshiro(UINT32 *s);
+void JumpXoshiro(UINT32 *s);
+void DrawReplicates(UINT32 *states, int nreps, REAL p,
+                    unsigned char *flags);
+BOOL ReplicateData(FILE *in, FILE *out, char *prefix, int nreps,
+                   unsigned long seed, int valCol, int keyCol,
+                   GROUPTABLE *groups, REAL targetMean, REAL targetSD);
 
 
 /************************************************************************/
@@ -129,35 +445,364 @@ void Usage(void);
    Returns:   
 
    24.07.09  Original   By: ACRM
+   19.10.26  Added grouped mode   By: agent
+   19.10.26  Added follow mode and -s   By: agent
+   19.10.26  Added multivariate mode   By: agent
+   19.10.26  Added column file input   By: agent
+   19.10.26  Added quality statistics   By: agent
+   19.10.26  Added bounded memory mode   By: agent
+   19.10.26  Added replicate mode   By: agent
+   19.10.26  Checks follow mode input and parameters   By: agent
+   19.10.26  Quality statistics kept in the checkpoint   By: agent
+   19.10.26  Reports selected records with no key   By: agent
+   19.10.26  Restores the follow mode output after a failed run
+             By: agent
 */
 int main(int argc, char **argv)
 {
-   REALLIST *data = NULL;
-   REALLIST *newdata = NULL;
-   REAL targetMean;
-   REAL targetSD;
-   FILE *in  = stdin,
-        *out = stdout;
-   char InFile[MAXBUFF],
-        OutFile[MAXBUFF];
+   REALLIST      *data = NULL;
+   REALLIST      *newdata = NULL;
+   GROUPTABLE    *groups = NULL;
+   CHECKPOINT    ckpt;
+   STATS         stats,
+                 *pStats = NULL;
+   REAL          targetMean;
+   REAL          targetSD,
+                 maxKS;
+   unsigned long memLimit;
+   MVMODEL       model;
+   int           cols[MAXDIM],
+                 ncols,
+                 nreps,
+                 valCol,
+                 keyCol = 0,
+                 i;
+   COLFILE       *cf;
+   COLUMN        *col;
+   unsigned long seed,
+                 groupHash = 0UL;
+   long          nokey = 0L;
+   BOOL          haveSeed,
+                 found,
+                 indexOut,
+                 quality;
+   FILE          *in  = stdin,
+                 *out = stdout,
+                 *fp;
+   char          InFile[MAXBUFF],
+                 OutFile[MAXBUFF],
+                 GroupFile[MAXBUFF],
+                 GroupPrefix[MAXBUFF],
+                 CkptFile[MAXBUFF],
+                 ModelFile[MAXBUFF],
+                 RawColumn[MAXBUFF],
+                 RepPrefix[MAXBUFF];
    
 
-   if(ParseCmdLine(argc, argv, InFile, OutFile, &targetMean, &targetSD))
+   if(ParseCmdLine(argc, argv, InFile, OutFile, &targetMean, &targetSD,
+                   cols, &ncols, &keyCol, GroupFile, GroupPrefix,
+                   &seed, &haveSeed, CkptFile, ModelFile, RawColumn,
+                   &indexOut, &quality, &maxKS, &memLimit, &nreps,
+                   RepPrefix))
    {
-      if(OpenStdFiles(InFile, OutFile, &in, &out))
+      if(!haveSeed)
+         seed = (unsigned long)time(NULL);
+      SeedRandom(seed);
+      valCol = cols[0];
+      if(quality)
+      {
+         InitStats(&stats);
+         pStats = &stats;
+      }
+
+      if(RawColumn[0])
+      {
+         if((cf = OpenColFile(InFile))==NULL)
+         {
+            fprintf(stderr,"Error: %s is not a valid column file\n",
+                    InFile);
+            return(1);
+         }
+         if(((col = FindColumn(cf, RawColumn))==NULL) ||
+            (strcmp(col->type, "f8") && strcmp(col->type, "f4")))
+         {
+            fprintf(stderr,"Error: No f8 or f4 column called %s in %s\n",
+                    RawColumn, InFile);
+            return(1);
+         }
+         if(OutFile[0] && ((out=fopen(OutFile, "wb"))==NULL))
+         {
+            fprintf(stderr,"Error: Unable to open output file %s\n",
+                    OutFile);
+            return(1);
+         }
+         if(!NormalizeColumn(out, col, cf->nrows, targetMean, targetSD,
+                             indexOut, pStats, memLimit))
+         {
+            fprintf(stderr,"Error: Unable to write column output\n");
+            return(1);
+         }
+         CloseColFile(cf);
+         return(quality ? 
+                ReportQuality(stderr, pStats, NULL, targetMean, targetSD,
+                              maxKS) : 0);
+      }
+
+      if(ModelFile[0])
+      {
+         if((fp=fopen(ModelFile, "r"))==NULL)
+         {
+            fprintf(stderr,"Error: Unable to open model file %s\n",
+                    ModelFile);
+            return(1);
+         }
+         if(!ReadModel(fp, &model))
+         {
+            fprintf(stderr,"Error: Model file %s must contain a mean \
+vector followed by a\n       positive definite covariance matrix\n",
+                    ModelFile);
+            return(1);
+         }
+         fclose(fp);
+
+         /* Default to the first d columns                              */
+         if(ncols == 0)
+         {
+            for(i=0; i<model.ndim; i++)
+               cols[i] = i+1;
+            ncols = model.ndim;
+         }
+         if(ncols != model.ndim)
+         {
+            fprintf(stderr,"Error: %d columns given for a %d dimensional \
+model\n", ncols, model.ndim);
+            return(1);
+         }
+         for(i=0; i<ncols; i++)
+            model.cols[i] = cols[i];
+
+         if(!OpenStdFiles(InFile, OutFile, &in, &out))
+         {
+            fprintf(stderr,"Error: Unable to open input or output file\n");
+            return(1);
+         }
+         if(!NormalizeMultiData(in, out, &model, pStats))
+         {
+            fprintf(stderr,"Error: No memory for multivariate data\n");
+            return(1);
+         }
+         return(quality ? 
+                ReportQuality(stderr, pStats, NULL, (REAL)model.ndim,
+                              sqrt((REAL)(2*model.ndim)), maxKS) : 0);
+      }
+
+      if(keyCol)
+      {
+         if((groups = CreateGroupTable())==NULL)
+         {
+            fprintf(stderr,"Error: No memory for group table\n");
+            return(1);
+         }
+         if(GroupFile[0])
+         {
+            if((fp=fopen(GroupFile, "r"))==NULL)
+            {
+               fprintf(stderr,"Error: Unable to open group file %s\n",
+                       GroupFile);
+               return(1);
+            }
+            if(!ReadGroupTable(fp, groups) ||
+               fseek(fp, 0L, SEEK_SET) ||
+               !HashHead(fp, -1L, &groupHash))
+            {
+               fprintf(stderr,"Error: Unable to read group file %s\n",
+                       GroupFile);
+               return(1);
+            }
+            fclose(fp);
+         }
+      }
+
+      if(CkptFile[0])
+      {
+         if(!ReadCheckpoint(CkptFile, &ckpt, groups, targetMean,
+                            targetSD, &found))
+         {
+            fprintf(stderr,"Error: Invalid checkpoint file %s\n",
+                    CkptFile);
+            return(1);
+         }
+         if(!found)
+         {
+            ckpt.offset     = 0L;
+            ckpt.outLen     = OutFile[0] ? FileLength(OutFile) : -1L;
+            ckpt.randState  = gRandState;
+            ckpt.headLen    = 0L;
+            ckpt.headHash   = HashKey("");
+            ckpt.targetMean = targetMean;
+            ckpt.targetSD   = targetSD;
+            ckpt.valCol     = valCol;
+            ckpt.keyCol     = keyCol;
+            ckpt.groupHash  = groupHash;
+         }
+         else if((ckpt.targetMean != targetMean) ||
+                 (ckpt.targetSD   != targetSD)   ||
+                 (ckpt.valCol     != valCol)     ||
+                 (ckpt.keyCol     != keyCol)     ||
+                 (ckpt.groupHash  != groupHash)  ||
+                 ((ckpt.outLen < 0L) != (OutFile[0] == '\0')))
+         {
+            fprintf(stderr,"Error: Checkpoint %s was made with a different \
+mean, sd, -c, -k, -g\n       or output file\n", CkptFile);
+            return(1);
+         }
+         gRandState = ckpt.randState;
+         
+         if((in=fopen(InFile, "r"))==NULL)
+         {
+            fprintf(stderr,"Error: Unable to open input file %s\n",
+                    InFile);
+            return(1);
+         }
+         switch(CheckFollowInput(in, &ckpt))
+         {
+         case FOLLOW_OK:
+            break;
+         case FOLLOW_SHRUNK:
+            fprintf(stderr,"Error: %s is shorter than when checkpoint %s \
+was made.\n       Has it been truncated or rotated?\n", InFile, CkptFile);
+            return(1);
+         case FOLLOW_CHANGED:
+            fprintf(stderr,"Error: %s is not the file checkpoint %s was \
+made from.\n       Has it been rotated or replaced?\n", InFile, CkptFile);
+            return(1);
+         default:
+            fprintf(stderr,"Error: Unable to read input file %s\n",
+                    InFile);
+            return(1);
+         }
+         /* Remove anything a failed run appended after the last
+            checkpoint, and save a checkpoint before the first run writes
+            anything, so an interrupted run can always be repeated
+         */
+         if(OutFile[0])
+         {
+            switch(CheckFollowOutput(OutFile, &ckpt))
+            {
+            case FOLLOW_OK:
+               break;
+            case FOLLOW_SHRUNK:
+               fprintf(stderr,"Error: %s is shorter than when checkpoint \
+%s was made\n", OutFile, CkptFile);
+               return(1);
+            default:
+               fprintf(stderr,"Error: Unable to restore output file %s\n",
+                       OutFile);
+               return(1);
+            }
+         }
+         if(!found && !WriteCheckpoint(CkptFile, &ckpt, groups))
+         {
+            fprintf(stderr,"Error: Unable to write checkpoint file %s\n",
+                    CkptFile);
+            return(1);
+         }
+         if(OutFile[0] && ((out=fopen(OutFile, "a"))==NULL))
+         {
+            fprintf(stderr,"Error: Unable to open output file %s\n",
+                    OutFile);
+            return(1);
+         }
+         if(!FollowData(in, out, &ckpt, valCol, keyCol, groups,
+                        targetMean, targetSD))
+         {
+            fprintf(stderr,"Error: Unable to process new input data\n");
+            return(1);
+         }
+         if(!WriteCheckpoint(CkptFile, &ckpt, groups))
+         {
+            fprintf(stderr,"Error: Unable to write checkpoint file %s\n",
+                    CkptFile);
+            return(1);
+         }
+         /* Report on everything written since the checkpoint began     */
+         pStats = &(ckpt.stats);
+      }
+      else if(!OpenStdFiles(InFile, OutFile, &in, &out))
+      {
+         fprintf(stderr,"Error: Unable to open input or output file\n");
+         return(1);
+      }
+      else if(nreps)
+      {
+         if(!ReplicateData(in, out, RepPrefix, nreps, seed, valCol, 
+                           keyCol, groups, targetMean, targetSD))
+         {
+            fprintf(stderr,"Error: Unable to write replicate output\n");
+            return(1);
+         }
+      }
+      else if(memLimit)
+      {
+         if(GroupPrefix[0])
+         {
+            if(!StreamGroupData(in, GroupPrefix, valCol, keyCol, groups,
+                                targetMean, targetSD, pStats, memLimit,
+                                &nokey))
+            {
+               fprintf(stderr,"Error: Unable to write per-group \
+output\n");
+               return(1);
+            }
+         }
+         else if(!StreamData(in, out, valCol, keyCol, groups, 
+                             targetMean, targetSD, pStats))
+         {
+            fprintf(stderr,"Error: Unable to write output\n");
+            return(1);
+         }
+      }
+      else
       {
-         if((data = ReadData(in))==NULL)
+         if((data = ReadData(in, valCol, keyCol, groups,
+                             targetMean, targetSD))==NULL)
          {
             fprintf(stderr,"Error: Unable to read input data\n");
             return(1);
          }
-         if((newdata = NormalizeData(data, targetMean, targetSD))==NULL)
+         if((newdata = NormalizeData(data, targetMean, targetSD, 
+                                     groups, pStats))==NULL)
          {
             fprintf(stderr,"Error: Unable to build output data list\n");
             return(1);
          }
 
-         PrintData(out, newdata);
+         if(GroupPrefix[0])
+         {
+            if(!PrintGroupData(GroupPrefix, newdata, groups, &nokey))
+            {
+               fprintf(stderr,"Error: Unable to write per-group \
+output\n");
+               return(1);
+            }
+         }
+         else
+         {
+            PrintData(out, newdata);
+         }
+      }
+
+      if(nokey)
+      {
+         fprintf(stderr,"Warning: %ld selected records had no key field \
+and were not written\n", nokey);
+      }
+
+      if(quality)
+      {
+         fflush(out);
+         return(ReportQuality(stderr, pStats, groups, targetMean, 
+                              targetSD, maxKS));
       }
    }
    else
@@ -171,7 +816,13 @@ int main(int argc, char **argv)
 
 /************************************************************************/
 /*>BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                     REAL *targetMean, REAL *targetSD)
+                     REAL *targetMean, REAL *targetSD, int *cols,
+                     int *ncols, int *keyCol, char *groupFile,
+                     char *groupPrefix, unsigned long *seed, BOOL *haveSeed,
+                     char *ckptFile, char *modelFile, char *rawColumn,
+                     BOOL *indexOut, BOOL *quality, REAL *maxKS,
+                     unsigned long *memLimit, int *nreps,
+                     char *repPrefix)
    ----------------------------------------------------------------------
    Input:   int    argc        Argument count
             char   **argv      Argument array
@@ -179,19 +830,60 @@ int main(int argc, char **argv)
             char   *outfile    Output filename (or blank string)
             REAL   *targetMean target mean
             REAL   *targetSD   target standard deviation
+            int    *cols       Column(s) containing the value (from 1)
+                               cols[0] is 1 if none were given
+            int    *ncols      Number of columns given with -c
+            int    *keyCol     Column containing the group key (0=none)
+            char   *groupFile  Per-group target file (or blank string)
+            char   *groupPrefix Per-group output prefix (or blank)
+            unsigned long *seed Random number seed
+            BOOL   *haveSeed   Was a seed given?
+            char   *ckptFile   Follow mode checkpoint file (or blank)
+            char   *modelFile  Multivariate model file (or blank)
+            char   *rawColumn  Column file value column (or blank)
+            BOOL   *indexOut   Write an index column, not a bool column
+            BOOL   *quality    Report output quality statistics
+            REAL   *maxKS      Maximum KS distance (0 = no limit)
+            unsigned long *memLimit Memory limit in bytes (0 = none)
+            int    *nreps      Number of replicates (0 = normal run)
+            char   *repPrefix  Per-replicate output prefix (or blank)
    Returns: BOOL               Success
 
    Parse the command line
 
    24.07.09 Original   By: ACRM
+   19.10.26 Added -c, -k, -g and -p   By: agent
+   19.10.26 Added -s and -f   By: agent
+   19.10.26 Added -M and column lists for -c   By: agent
+   19.10.26 Added -r and -i   By: agent
+   19.10.26 Added -q and -Q   By: agent
+   19.10.26 Added -L and --mem-limit   By: agent
+   19.10.26 Added -R and -x   By: agent
+   19.10.26 Rejects repeated -c columns and -g/-p with -M   By: agent
+   19.10.26 -s, -k and -Q must parse exactly one value   By: agent
 */
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                  REAL *targetMean, REAL *targetSD)
+                  REAL *targetMean, REAL *targetSD, int *cols,
+                  int *ncols, int *keyCol, char *groupFile,
+                  char *groupPrefix, unsigned long *seed, BOOL *haveSeed,
+                  char *ckptFile, char *modelFile, char *rawColumn,
+                  BOOL *indexOut, BOOL *quality, REAL *maxKS,
+                  unsigned long *memLimit, int *nreps,
+                  char *repPrefix)
 {
+   char *chp;
+   int  i, j;
+   
    argc--;
    argv++;
    
-   infile[0] = outfile[0] = '\0';
+   infile[0] = outfile[0] = groupFile[0] = groupPrefix[0] = '\0';
+   ckptFile[0] = modelFile[0] = rawColumn[0] = repPrefix[0] = '\0';
+   *haveSeed   = *indexOut = *quality = FALSE;
+   *maxKS      = (REAL)0.0;
+   *memLimit   = 0UL;
+   *ncols      = *nreps = 0;
+   cols[0]     = 1;
 
    if(!argc)
       return(FALSE);
@@ -202,6 +894,133 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
       {
          switch(argv[0][1])
          {
+         case 'c':
+            argc--;
+            argv++;
+            if(!argc)
+               return(FALSE);
+            for(chp=argv[0], *ncols=0; chp!=NULL; *ncols += 1)
+            {
+               if((*ncols == MAXDIM) ||
+                  (sscanf(chp, "%d", &(cols[*ncols])) != 1) ||
+                  (cols[*ncols] < 1) || (cols[*ncols] > MAXCOLS))
+                  return(FALSE);
+               for(j=0; j<*ncols; j++)
+               {
+                  if(cols[j] == cols[*ncols])
+                     return(FALSE);
+               }
+               if((chp = strchr(chp, ',')) != NULL)
+                  chp++;
+            }
+            break;
+         case 'M':
+            argc--;
+            argv++;
+            if(!argc)
+               return(FALSE);
+            strncpy(modelFile, argv[0], MAXBUFF-1);
+            modelFile[MAXBUFF-1] = '\0';
+            break;
+         case 'r':
+            argc--;
+            argv++;
+            if(!argc || (strlen(argv[0]) >= COL_NAMELEN))
+               return(FALSE);
+            strcpy(rawColumn, argv[0]);
+            break;
+         case 'i':
+            *indexOut = TRUE;
+            break;
+         case 'q':
+            *quality = TRUE;
+            break;
+         case 'Q':
+            argc--;
+            argv++;
+            if(!argc || (sscanf(argv[0], "%lf", maxKS) != 1) || 
+               (*maxKS <= (REAL)0.0))
+               return(FALSE);
+            *quality = TRUE;
+            break;
+         case 'L':
+            argc--;
+            argv++;
+            if(!argc || !ParseSize(argv[0], memLimit))
+               return(FALSE);
+            break;
+         case '-':
+            /* --mem-limit size or --mem-limit=size                     */
+            if(!strcmp(argv[0], "--mem-limit"))
+            {
+               argc--;
+               argv++;
+               if(!argc || !ParseSize(argv[0], memLimit))
+                  return(FALSE);
+            }
+            else if(!strncmp(argv[0], "--mem-limit=", 12))
+            {
+               if(!ParseSize(argv[0]+12, memLimit))
+                  return(FALSE);
+            }
+            else
+            {
+               return(FALSE);
+            }
+            break;
+         case 'R':
+            argc--;
+            argv++;
+            if(!argc || (sscanf(argv[0], "%d", nreps) != 1) ||
+               (*nreps < 1) || (*nreps > MAXREPS))
+               return(FALSE);
+            break;
+         case 'x':
+            argc--;
+            argv++;
+            if(!argc)
+               return(FALSE);
+            strncpy(repPrefix, argv[0], MAXBUFF-1);
+            repPrefix[MAXBUFF-1] = '\0';
+            break;
+         case 'k':
+            argc--;
+            argv++;
+            if(!argc || (sscanf(argv[0], "%d", keyCol) != 1) ||
+               (*keyCol < 1))
+               return(FALSE);
+            break;
+         case 'g':
+            argc--;
+            argv++;
+            if(!argc)
+               return(FALSE);
+            strncpy(groupFile, argv[0], MAXBUFF-1);
+            groupFile[MAXBUFF-1] = '\0';
+            break;
+         case 'p':
+            argc--;
+            argv++;
+            if(!argc)
+               return(FALSE);
+            strncpy(groupPrefix, argv[0], MAXBUFF-1);
+            groupPrefix[MAXBUFF-1] = '\0';
+            break;
+         case 's':
+            argc--;
+            argv++;
+            if(!argc || (sscanf(argv[0], "%lu", seed) != 1))
+               return(FALSE);
+            *haveSeed = TRUE;
+            break;
+         case 'f':
+            argc--;
+            argv++;
+            if(!argc)
+               return(FALSE);
+            strncpy(ckptFile, argv[0], MAXBUFF-1);
+            ckptFile[MAXBUFF-1] = '\0';
+            break;
          case 'h':
             return(FALSE);
             break;
@@ -210,6 +1029,18 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
             break;
          }
       }
+      else if(modelFile[0])
+      {
+         /* The model file replaces the mean and sd so there are just
+            0-2 filenames
+         */
+         if(argc > 2)
+            return(FALSE);
+         strcpy(infile, argv[0]);
+         if(argc == 2)
+            strcpy(outfile, argv[1]);
+         break;
+      }
       else
       {
          /* Check that there are 2-4 arguments left                     */
@@ -236,13 +1067,60 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
             if(argc)
                strcpy(outfile, argv[0]);
          }
+
+         /* Group targets and per-group output only make sense with a
+            key column distinct from the value column
+         */
+         if(!(*keyCol) && (groupFile[0] || groupPrefix[0]))
+            return(FALSE);
+         for(i=0; i<MAX(*ncols, 1); i++)
+         {
+            if(*keyCol == cols[i])
+               return(FALSE);
+         }
+         if(*ncols > 1)
+            return(FALSE);
+
+         /* Follow mode must be able to seek in a named input file and
+            appends to a single output
+         */
+         if(ckptFile[0] && (!infile[0] || groupPrefix[0]))
+            return(FALSE);
+
+         /* Column files are mapped so must be named. The column is
+            chosen by name and there are no text records to group
+         */
+         if(rawColumn[0] && 
+            (!infile[0] || *ncols || *keyCol || ckptFile[0]))
+            return(FALSE);
+         if(*indexOut && !rawColumn[0])
+            return(FALSE);
+
+         /* Replicates are text mode only and have their own output.
+            Each one needs an open file with -x
+         */
+         if(*nreps && (ckptFile[0] || rawColumn[0] || groupPrefix[0] ||
+                       *quality))
+            return(FALSE);
+         if(repPrefix[0] && (!(*nreps) || (*nreps > MAXREPFILES)))
+            return(FALSE);
+
          return(TRUE);
       }
       argc--;
       argv++;
    }
    
-   return(TRUE);
+   /* In multivariate mode we may have had only options. Grouped and 
+      follow modes are not supported.
+   */
+   if(modelFile[0])
+      return((BOOL)(!(*keyCol) && !groupFile[0] && !groupPrefix[0] &&
+                    !ckptFile[0] && !rawColumn[0] && !(*indexOut) &&
+                    !(*nreps) && !repPrefix[0]));
+
+   /* Only options were given - we need at least the mean and sd        */
+   return(FALSE);
 }
 
 
@@ -250,13 +1128,69 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 /*>void Usage(void)
    ----------------
    10.03.09 Original   By: ACRM
+   19.10.26 V1.1-V1.7: grouped, follow, multivariate, column file,
+            quality, bounded memory and replicate options   By: agent
 */
 void Usage(void)
 {
    fprintf(stdout,
-"\nnormalize V1.0 (c) 2009, Dr. Andrew C.R. Martin, UCL\n\n\
-Usage: normalize mean sd [in.dat [out.dat]]\n\n\
-Samples the input dataset and writes a new set where the data are\n\
+"\nnormalize V1.7 (c) 2009, Dr. Andrew C.R. Martin, UCL\n\n\
+Usage: normalize [-c valcol] [-k keycol [-g groups.dat] [-p prefix]]\n\
+                 [-s seed] [-f checkpoint] mean sd [in.dat [out.dat]]\n\
+       normalize -M model.dat [-c col,col,...] [-s seed]\n\
+                 [in.dat [out.dat]]\n\
+       normalize -r column [-i] [-s seed] mean sd in.col [out.col]\n");
+   fprintf(stdout,
+"       normalize -R nreps [-x prefix] [-c valcol] [-k keycol\n\
+                 [-g groups.dat]] [-s seed] mean sd [in.dat [out.dat]]\n\
+       All modes also take [-L size] and, except -R, [-q] [-Q maxks]\n");
+   fprintf(stdout,
+"       -c Take the value from this column (default: 1)\n\
+       -k Group records by the key in this column\n\
+       -g Read per-group targets from this file ('key mean sd' lines);\n\
+          keys not listed use the mean and sd from the command line\n\
+       -p Write each group to its own file, prefix.key, rather than\n\
+          interleaving them in input order. '/' and '%%' in keys are\n\
+          written as %%2F and %%25. Records with no key field are not\n\
+          written; their number is reported on stderr\n");
+   fprintf(stdout,
+"       -s Seed the random number generator (default: the time)\n\
+       -f Follow mode. Process only lines added to in.dat since the\n\
+          last run, appending to out.dat, and save the file offset,\n\
+          random number state and statistics in this checkpoint file.\n\
+          Repeated runs give the same output as one run with -s. If a\n\
+          run fails, the next cuts out.dat back to where the checkpoint\n\
+          left it; output to stdout can't be recovered this way\n");
+   fprintf(stdout,
+"       -M Multivariate mode. The model file contains the target mean\n\
+          vector on one line followed by the rows of the covariance\n\
+          matrix. Values are taken from the columns given with -c\n\
+          (default: the first d columns) and records are selected on\n\
+          the chi-squared tail probability of the Mahalanobis distance\n");
+   fprintf(stdout,
+"       -r Read the named f8 or f4 column from a raw column file (see\n\
+          colfile.c) by memory mapping it. Writes a column file with a\n\
+          u1 'selected' flag for each row\n\
+       -i With -r, write a u4 'index' column of selected rows instead\n");
+   fprintf(stdout,
+"       -q Report the achieved mean, SD and skewness, the acceptance\n\
+          rate and the Kolmogorov-Smirnov distance from the target on\n\
+          stderr. These are gathered while sampling - no second pass\n\
+       -Q As -q, but exit with status 2 if the KS distance exceeds maxks\n");
+   fprintf(stdout,
+"       -L Limit memory use to about this many bytes (k, M or G may be\n\
+          appended; also --mem-limit). Text is streamed and per-group\n\
+          and column output are built via temporary files. The output\n\
+          is identical\n");
+   fprintf(stdout,
+"       -R Draw this many independent samples (max %d) in one pass.\n\
+          Writes a line per input record with its membership of each\n\
+          sample as a hex bitset: the first digit holds samples 0-3\n\
+          with sample 0 as the high bit. Sample 0 is the normal output\n\
+       -x With -R, write the zero-based row numbers in sample k to\n\
+          prefix.k instead (max %d samples)\n", MAXREPS, MAXREPFILES);
+   fprintf(stdout,
+"\nSamples the input dataset and writes a new set where the data are\n\
 normally distributed with the required mean and standard deviation.\n");
    fprintf(stdout,
 "\nThe method is to calculate the absolute Z-score of each datapoint\n\
@@ -288,27 +1222,109 @@ void PrintData(FILE *out, REALLIST *newdata)
 
 
 /************************************************************************/
-/*>REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD)
+/*>BOOL PrintGroupData(char *prefix, REALLIST *newdata, GROUPTABLE *groups,
+                       long *nokey)
+   ------------------------------------------------------------------------
+   Input:     char       *prefix   Output filename prefix
+              REALLIST   *newdata  Selected data
+              GROUPTABLE *groups   Group table
+   Output:    long       *nokey    Number of records with no key
+   Returns:   BOOL                 Success
+
+   Writes each group's selected records to prefix.key (see
+   GroupFilename()). The output list is split into per-group sublists
+   (preserving input order within a group) so that only one output file
+   need be open at a time. Records without a key are not written but
+   are counted. The list in newdata is consumed.
+
+   19.10.26  Original   By: agent
+   19.10.26  Uses GroupFilename()   By: agent
+   19.10.26  Counts records with no key   By: agent
+*/
+BOOL PrintGroupData(char *prefix, REALLIST *newdata, GROUPTABLE *groups,
+                    long *nokey)
+{
+   REALLIST *n, *next;
+   GROUP    *g;
+   FILE     *fp;
+   char     filename[MAXBUFF];
+   int      i;
+
+   *nokey = 0L;
+   for(i=0; i<groups->ngroups; i++)
+      groups->groups[i].head = groups->groups[i].tail = NULL;
+
+   for(n=newdata; n!=NULL; n=next)
+   {
+      next    = n->next;
+      n->next = NULL;
+      if(n->group < 0)
+      {
+         (*nokey)++;
+         continue;
+      }
+      g       = &(groups->groups[n->group]);
+      if(g->tail == NULL)
+         g->head = n;
+      else
+         g->tail->next = n;
+      g->tail = n;
+   }
+
+   for(i=0; i<groups->ngroups; i++)
+   {
+      g = &(groups->groups[i]);
+      if(g->head == NULL)
+         continue;
+      
+      if(!GroupFilename(prefix, g->key, filename) ||
+         ((fp=fopen(filename, "w"))==NULL))
+         return(FALSE);
+      PrintData(fp, g->head);
+      fclose(fp);
+   }
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD,
+                           GROUPTABLE *groups, STATS *stats)
    -----------------------------------------------------------------------
-   Input:     
-   Output:    
-   Returns:   
+   Input:     REALLIST   *data       Input data
+              REAL       targetMean  Target mean
+              REAL       targetSD    Target standard deviation
+              GROUPTABLE *groups     Group table (or NULL)
+   I/O:       STATS      *stats      Quality statistics (or NULL)
+   Returns:   REALLIST   *           Selected data
+
+   Records belonging to a group are sampled against that group's target
+   rather than targetMean and targetSD.
 
    24.07.09  Original   By: ACRM
+   19.10.26  Added groups   By: agent
+   19.10.26  Uses SelectRecord()   By: agent
+   19.10.26  Added stats   By: agent
 */
-REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD)
+REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD,
+                        GROUPTABLE *groups, STATS *stats)
 {
    REALLIST *d, *n, *newdata = NULL;
-   REAL z,p,r;
+   BOOL     accepted;
 
-   srand((unsigned int)time(NULL));
-   
    for(d=data; d!=NULL; NEXT(d))
    {
-      z = ABS(((d->value - targetMean)/targetSD));
-      p = CalcProbability(z);
-      r = RandomNumber((REAL)1.0);
-      if(p >= r)
+      accepted = SelectRecord(d, targetMean, targetSD, groups);
+      if((stats != NULL) &&
+         !AccumulateRecord(d, accepted, targetMean, targetSD, groups, 
+                           stats))
+      {
+         FREELIST(newdata, REALLIST);
+         return(NULL);
+      }
+      
+      if(accepted)
       {
          if(newdata == NULL)
          {
@@ -325,6 +1341,7 @@ REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD)
             return(NULL);
          }
          n->value = d->value;
+         n->group = d->group;
          strcpy(n->data, d->data);
       }
    }
@@ -335,73 +1352,2436 @@ REALLIST *NormalizeData(REALLIST *data, REAL targetMean, REAL targetSD)
 /************************************************************************/
 /*>REAL RandomNumber(REAL maxval)
    ------------------------------
-   Input:     
-   Output:    
-   Returns:   
+   Input:     REAL   maxval   Maximum value
+   Returns:   REAL            Random number between 0 and maxval
+
+   Uses a 32-bit xorshift generator rather than rand() so that the
+   state can be saved in a follow mode checkpoint and the sequence is
+   the same on every platform.
 
    24.07.09  Original   By: ACRM
+   19.10.26  Uses xorshift32 state in gRandState   By: agent
 */
 REAL RandomNumber(REAL maxval)
 {
-   return(maxval * rand()/(REAL)RAND_MAX);
+   gRandState ^= (gRandState << 13) & 0xFFFFFFFFUL;
+   gRandState ^= gRandState >> 17;
+   gRandState ^= (gRandState << 5)  & 0xFFFFFFFFUL;
+   
+   return(maxval * gRandState/(REAL)0xFFFFFFFFUL);
 }
 
 
 /************************************************************************/
-/*>REALLIST *ReadData(FILE *fp)
-   ----------------------------
-   Input:     
-   Output:    
-   Returns:   
+/*>void SeedRandom(unsigned long seed)
+   -----------------------------------
+   Input:     unsigned long seed    Seed
 
-   24.07.09  Original   By: ACRM
+   Sets gRandState from a seed (see ScrambleSeed()).
+
+   19.10.26  Original   By: agent
+   19.10.26  Uses ScrambleSeed()   By: agent
 */
-REALLIST *ReadData(FILE *fp)
+void SeedRandom(unsigned long seed)
 {
-   REALLIST *data = NULL,
-      *d;
-   char buffer[MAXBUFF];
+   gRandState = ScrambleSeed(seed);
+}
 
-   srand((unsigned int)time(NULL));
-   
-   while(fgets(buffer, MAXBUFF, fp))
-   {
-      TERMINATE(buffer);
-      if(data == NULL)
-      {
-         INIT(data, REALLIST);
+
+/************************************************************************/
+/*>unsigned long ScrambleSeed(unsigned long seed)
+   ----------------------------------------------
+   Input:     unsigned long seed    Seed
+   Returns:   unsigned long         Non-zero 32-bit xorshift state
+
+   Scrambles a seed since xorshift needs a few rounds to recover from
+   states with few bits set, and the state may not be zero.
+
+   19.10.26  Original (split from SeedRandom())   By: agent
+*/
+unsigned long ScrambleSeed(unsigned long seed)
+{
+   seed  = (seed ^ 0x9E3779B9UL) & 0xFFFFFFFFUL;
+   seed  = ((seed ^ (seed >> 16)) * 0x85EBCA6BUL) & 0xFFFFFFFFUL;
+   seed  = ((seed ^ (seed >> 13)) * 0xC2B2AE35UL) & 0xFFFFFFFFUL;
+   seed ^= seed >> 16;
+
+   return(seed ? seed : 1UL);
+}
+
+
+/************************************************************************/
+/*>REALLIST *ReadData(FILE *fp, int valCol, int keyCol, GROUPTABLE *groups,
+                      REAL targetMean, REAL targetSD)
+   -----------------------------------------------------------------------
+   Input:     FILE       *fp         Input file
+              int        valCol      Column containing the value (from 1)
+              int        keyCol      Column containing the key (0=none)
+              REAL       targetMean  Default target mean for new keys
+              REAL       targetSD    Default target SD for new keys
+   I/O:       GROUPTABLE *groups     Group table - keys not already
+                                     present are added
+   Returns:   REALLIST   *           Linked list of data
+
+   Keys are interned as they are read so that each record simply stores
+   its group index. Records with no key field get a group of -1.
+
+   24.07.09  Original   By: ACRM
+   19.10.26  Added value and key columns   By: agent
+*/
+REALLIST *ReadData(FILE *fp, int valCol, int keyCol, GROUPTABLE *groups,
+                   REAL targetMean, REAL targetSD)
+{
+   REALLIST *data = NULL,
+      *d;
+   char buffer[MAXBUFF];
+
+   while(fgets(buffer, MAXBUFF, fp))
+   {
+      TERMINATE(buffer);
+      if(data == NULL)
+      {
+         INIT(data, REALLIST);
          d=data;
       }
       else
       {
          ALLOCNEXT(d, REALLIST);
       }
-      if(d==NULL)
+      if((d==NULL) || 
+         !ParseRecord(buffer, d, valCol, keyCol, groups, 
+                      targetMean, targetSD))
       {
          FREELIST(data, REALLIST);
+         return(NULL);
       }
-      sscanf(buffer, "%lf", &(d->value));
-      strcpy(d->data, buffer);
    }
    return(data);
 }
 
 
 /************************************************************************/
-/*>REAL CalcProbability(REAL z)
-   ----------------------------
-   Input:     
-   Output:    
-   Returns:   
+/*>BOOL ParseRecord(char *buffer, REALLIST *d, int valCol, int keyCol,
+                    GROUPTABLE *groups, REAL targetMean, REAL targetSD)
+   ---------------------------------------------------------------------
+   Input:     char       *buffer     Input line (newline removed)
+              int        valCol      Column containing the value (from 1)
+              int        keyCol      Column containing the key (0=none)
+              REAL       targetMean  Default target mean for new keys
+              REAL       targetSD    Default target SD for new keys
+   Output:    REALLIST   *d          Record to fill in
+   I/O:       GROUPTABLE *groups     Group table
+   Returns:   BOOL                   Success (FALSE if no memory)
 
-   24.07.09  Original   By: ACRM
+   Fills in the value, group and text of a record from a line of input
+
+   19.10.26  Original (split from ReadData())   By: agent
 */
-REAL CalcProbability(REAL z)
+BOOL ParseRecord(char *buffer, REALLIST *d, int valCol, int keyCol,
+                 GROUPTABLE *groups, REAL targetMean, REAL targetSD)
 {
-   REAL p;
-   p = (1+erff((double)(-z/sqrt(2))));
-   return(p);
+   char word[MAXBUFF];
+   
+   d->value = (REAL)0.0;
+   if(valCol == 1)
+   {
+      sscanf(buffer, "%lf", &(d->value));
+   }
+   else
+   {
+      if(GetField(buffer, valCol, word, MAXBUFF) != NULL)
+         sscanf(word, "%lf", &(d->value));
+   }
+
+   d->group = (-1);
+   if(keyCol && (GetField(buffer, keyCol, word, MAXBUFF) != NULL))
+   {
+      if((d->group = InternGroup(groups, word, 
+                                 targetMean, targetSD)) < 0)
+         return(FALSE);
+   }
+      
+   strcpy(d->data, buffer);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL SelectRecord(REALLIST *d, REAL targetMean, REAL targetSD,
+                     GROUPTABLE *groups)
+   --------------------------------------------------------------
+   Input:     REALLIST   *d          Record
+              REAL       targetMean  Target mean
+              REAL       targetSD    Target standard deviation
+              GROUPTABLE *groups     Group table (or NULL)
+   Returns:   BOOL                   Should the record be kept?
+
+   The sampling step for a single record. Exactly one random number is
+   drawn per call.
+
+   19.10.26  Original (split from NormalizeData())   By: agent
+   19.10.26  Uses SelectValue()   By: agent
+*/
+BOOL SelectRecord(REALLIST *d, REAL targetMean, REAL targetSD,
+                  GROUPTABLE *groups)
+{
+   REAL mean, sd;
+
+   GetTarget(d, targetMean, targetSD, groups, &mean, &sd);
+   return(SelectValue(d->value, mean, sd));
+}
+
+
+/************************************************************************/
+/*>void GetTarget(REALLIST *d, REAL targetMean, REAL targetSD,
+                  GROUPTABLE *groups, REAL *mean, REAL *sd)
+   -----------------------------------------------------------
+   Input:     REALLIST   *d          Record
+              REAL       targetMean  Default target mean
+              REAL       targetSD    Default target standard deviation
+              GROUPTABLE *groups     Group table (or NULL)
+   Output:    REAL       *mean       Target mean for this record
+              REAL       *sd         Target SD for this record
+
+   19.10.26  Original (split from SelectRecord())   By: agent
+*/
+void GetTarget(REALLIST *d, REAL targetMean, REAL targetSD,
+               GROUPTABLE *groups, REAL *mean, REAL *sd)
+{
+   if((groups != NULL) && (d->group >= 0))
+   {
+      *mean = groups->groups[d->group].mean;
+      *sd   = groups->groups[d->group].sd;
+   }
+   else
+   {
+      *mean = targetMean;
+      *sd   = targetSD;
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL AccumulateRecord(REALLIST *d, BOOL accepted, REAL targetMean,
+                         REAL targetSD, GROUPTABLE *groups, STATS *stats)
+   ----------------------------------------------------------------------
+   Input:     REALLIST   *d          Record
+              BOOL       accepted    Was it selected?
+              REAL       targetMean  Default target mean
+              REAL       targetSD    Default target standard deviation
+   I/O:       GROUPTABLE *groups     Group table (or NULL)
+              STATS      *stats      Statistics for ungrouped records
+   Returns:   BOOL                   Success (FALSE if no memory)
+
+   Adds a record to the quality statistics. Grouped records go to their
+   group's own accumulator, which is created when first needed.
+
+   19.10.26  Original   By: agent
+*/
+BOOL AccumulateRecord(REALLIST *d, BOOL accepted, REAL targetMean,
+                      REAL targetSD, GROUPTABLE *groups, STATS *stats)
+{
+   GROUP *g;
+   REAL  mean, sd;
+
+   if((groups != NULL) && (d->group >= 0))
+   {
+      g = &(groups->groups[d->group]);
+      if(g->stats == NULL)
+      {
+         if((g->stats = (STATS *)malloc(sizeof(STATS)))==NULL)
+            return(FALSE);
+         InitStats(g->stats);
+      }
+      stats = g->stats;
+   }
+
+   stats->seen++;
+   if(accepted)
+   {
+      GetTarget(d, targetMean, targetSD, groups, &mean, &sd);
+      AddStats(stats, d->value, NormalCDF((d->value - mean) / sd));
+   }
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int ReportQuality(FILE *fp, STATS *stats, GROUPTABLE *groups,
+                     REAL targetMean, REAL targetSD, REAL maxKS)
+   -------------------------------------------------------------
+   Input:     FILE       *fp         Output file (normally stderr)
+              GROUPTABLE *groups     Group table (or NULL)
+              REAL       targetMean Target mean
+              REAL       targetSD    Target standard deviation
+              REAL       maxKS       Maximum KS distance (0 = no limit)
+   I/O:       STATS      *stats      Statistics - the groups are merged
+                                     into this
+   Returns:   int                    Exit status: 0, or 2 if the KS 
+                                     distance is too large
+
+   Prints a line for each group (if any) and one for everything. With
+   groups the overall moments mix different targets so only the counts
+   and KS distance are shown for everything.
+
+   19.10.26  Original   By: agent
+*/
+int ReportQuality(FILE *fp, STATS *stats, GROUPTABLE *groups,
+                  REAL targetMean, REAL targetSD, REAL maxKS)
+{
+   GROUP *g;
+   REAL  ks;
+   int   i;
+
+   if(groups != NULL)
+   {
+      if(stats->seen)
+         PrintStats(fp, "(no key)", stats, TRUE, targetMean, targetSD);
+
+      for(i=0; i<groups->ngroups; i++)
+      {
+         g = &(groups->groups[i]);
+         if(g->stats != NULL)
+         {
+            PrintStats(fp, g->key, g->stats, TRUE, g->mean, g->sd);
+            MergeStats(stats, g->stats);
+         }
+      }
+   }
+   PrintStats(fp, "all", stats, (BOOL)(groups == NULL), 
+              targetMean, targetSD);
+
+   ks = StatsKS(stats);
+   if((maxKS > (REAL)0.0) && (ks > maxKS))
+   {
+      fprintf(fp, "Error: KS distance %.4f exceeds the limit of %.4f\n",
+              ks, maxKS);
+      return(2);
+   }
+   return(0);
+}
+
+
+/************************************************************************/
+/*>void PrintStats(FILE *fp, char *label, STATS *stats, BOOL showMoments,
+                   REAL targetMean, REAL targetSD)
+   ----------------------------------------------------------------------
+   Input:     FILE   *fp          Output file
+              char   *label       Label for the line
+              STATS  *stats       Statistics
+              BOOL   showMoments  Print the mean, SD and skewness
+              REAL   targetMean   Target mean
+              REAL   targetSD     Target standard deviation
+
+   19.10.26  Original   By: agent
+*/
+void PrintStats(FILE *fp, char *label, STATS *stats, BOOL showMoments,
+                REAL targetMean, REAL targetSD)
+{
+   fprintf(fp, "Quality %s: %lu read, %lu accepted (%.2f%%)",
+           label, stats->seen, stats->n,
+           stats->seen ? (REAL)100.0 * stats->n / stats->seen : (REAL)0.0);
+   if(showMoments)
+   {
+      fprintf(fp, ", mean %g (target %g), SD %g (target %g), \
+skewness %.4f", stats->mean, targetMean, StatsSD(stats), targetSD,
+              StatsSkew(stats));
+   }
+   fprintf(fp, ", KS %.4f\n", StatsKS(stats));
+}
+
+
+/************************************************************************/
+/*>BOOL SelectValue(REAL value, REAL mean, REAL sd)
+   ------------------------------------------------
+   Input:     REAL   value    Value
+              REAL   mean     Target mean
+              REAL   sd       Target standard deviation
+   Returns:   BOOL            Should the value be kept?
+
+   Draws exactly one random number
+
+   19.10.26  Original (split from SelectRecord())   By: agent
+*/
+BOOL SelectValue(REAL value, REAL mean, REAL sd)
+{
+   REAL z, p, r;
+
+   z = ABS(((value - mean)/sd));
+   p = CalcProbability(z);
+   r = RandomNumber((REAL)1.0);
+
+   return((BOOL)(p >= r));
+}
+
+
+/************************************************************************/
+/*>BOOL FollowData(FILE *in, FILE *out, CHECKPOINT *ckpt, int valCol,
+                   int keyCol, GROUPTABLE *groups, REAL targetMean,
+                   REAL targetSD)
+   -------------------------------------------------------------------
+   Input:     FILE       *in         Input file
+              FILE       *out        Output file
+              int        valCol      Column containing the value (from 1)
+              int        keyCol      Column containing the key (0=none)
+              GROUPTABLE *groups     Group table (or NULL)
+              REAL       targetMean  Target mean
+              REAL       targetSD    Target standard deviation
+   I/O:       CHECKPOINT *ckpt       Checkpoint - updated on return
+   Returns:   BOOL                   Success
+
+   Processes the input from the checkpoint offset, streaming each line
+   through SelectRecord() and writing accepted lines as they are found.
+   A final line that does not yet end in a newline is not consumed.
+   The random number state is taken from gRandState which the caller
+   must already have restored from the checkpoint, and the caller must
+   have checked the file with CheckFollowInput(). Quality statistics
+   are always gathered, into the checkpoint's accumulator (or the
+   groups'), so they cover every run and not just this one.
+
+   19.10.26  Original   By: agent
+   19.10.26  Added stats   By: agent
+   19.10.26  Updates the head hash   By: agent
+   19.10.26  Statistics kept in the checkpoint   By: agent
+   19.10.26  Records the output length   By: agent
+*/
+BOOL FollowData(FILE *in, FILE *out, CHECKPOINT *ckpt, int valCol,
+                int keyCol, GROUPTABLE *groups, REAL targetMean,
+                REAL targetSD)
+{
+   REALLIST rec;
+   BOOL     accepted;
+   char     buffer[MAXBUFF];
+   long     offset = ckpt->offset;
+   size_t   len;
+
+   if(fseek(in, offset, SEEK_SET))
+      return(FALSE);
+   
+   while(fgets(buffer, MAXBUFF, in))
+   {
+      len = strlen(buffer);
+      if((buffer[len-1] != '\n') && feof(in))
+         break;
+      offset += (long)len;
+
+      TERMINATE(buffer);
+      if(!ParseRecord(buffer, &rec, valCol, keyCol, groups,
+                      targetMean, targetSD))
+         return(FALSE);
+
+      accepted = SelectRecord(&rec, targetMean, targetSD, groups);
+      if(!AccumulateRecord(&rec, accepted, targetMean, targetSD, groups,
+                           &(ckpt->stats)))
+         return(FALSE);
+
+      if(accepted)
+         fprintf(out, "%s\n", rec.data);
+   }
+   if(ferror(in) || fflush(out))
+      return(FALSE);
+
+   ckpt->offset    = offset;
+   ckpt->randState = gRandState;
+   if(ckpt->outLen >= 0L)
+   {
+      if(fseek(out, 0L, SEEK_END) || ((ckpt->outLen = ftell(out)) < 0L))
+         return(FALSE);
+   }
+
+   /* Until CKPTHEAD bytes have been read the identifying hash grows   */
+   if(ckpt->headLen < CKPTHEAD)
+   {
+      ckpt->headLen = MIN(offset, CKPTHEAD);
+      if(fseek(in, 0L, SEEK_SET) ||
+         !HashHead(in, ckpt->headLen, &(ckpt->headHash)))
+         return(FALSE);
+   }
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadCheckpoint(char *filename, CHECKPOINT *ckpt, 
+                       GROUPTABLE *groups, REAL targetMean,
+                       REAL targetSD, BOOL *found)
+   ----------------------------------------------------------------
+   Input:     char       *filename   Checkpoint file
+              REAL       targetMean  Default target mean for new keys
+              REAL       targetSD    Default target SD for new keys
+   Output:    CHECKPOINT *ckpt       Checkpoint
+              BOOL       *found      Did the file exist?
+   I/O:       GROUPTABLE *groups     Group table (or NULL) - groups in
+                                     the checkpoint are added with
+                                     their statistics
+   Returns:   BOOL                   Success (TRUE if no file)
+
+   The statistics are a 'stats' line and sparse 'hist' lines for the
+   ungrouped records, then the same after a 'group key' line for each
+   group (see WriteCheckpoint()).
+
+   19.10.26  Original   By: agent
+   19.10.26  Added input identity and parameters   By: agent
+   19.10.26  Statistics replace sum and sumsq   By: agent
+   19.10.26  Added output length   By: agent
+*/
+BOOL ReadCheckpoint(char *filename, CHECKPOINT *ckpt, GROUPTABLE *groups,
+                    REAL targetMean, REAL targetSD, BOOL *found)
+{
+   FILE  *fp;
+   GROUP *g;
+   STATS *s;
+   char  buffer[MAXBUFF],
+         key[MAXBUFF];
+   int   nfields = 0,
+         nstats  = 0,
+         i;
+   BOOL  ok      = TRUE;
+   unsigned long count;
+
+   InitStats(&(ckpt->stats));
+   if((fp=fopen(filename, "r"))==NULL)
+   {
+      *found = FALSE;
+      return(TRUE);
+   }
+   *found = TRUE;
+
+   s = &(ckpt->stats);
+   while(ok && fgets(buffer, MAXBUFF, fp))
+   {
+      if(!strncmp(buffer, "group ", 6))
+      {
+         if((groups == NULL) || (sscanf(buffer+6, "%s", key) != 1) ||
+            ((i = InternGroup(groups, key, targetMean, targetSD)) < 0))
+         {
+            ok = FALSE;
+            break;
+         }
+         g = &(groups->groups[i]);
+         if((g->stats == NULL) &&
+            ((g->stats = (STATS *)malloc(sizeof(STATS)))==NULL))
+         {
+            ok = FALSE;
+            break;
+         }
+         s = g->stats;
+         InitStats(s);
+      }
+      else if(!strncmp(buffer, "stats ", 6))
+      {
+         if(sscanf(buffer+6, "%lu %lu %lf %lf %lf", &(s->seen), &(s->n),
+                   &(s->mean), &(s->m2), &(s->m3)) != 5)
+            ok = FALSE;
+         else if(s == &(ckpt->stats))
+            nstats++;
+      }
+      else if(!strncmp(buffer, "hist ", 5))
+      {
+         if((sscanf(buffer+5, "%d %lu", &i, &count) != 2) ||
+            (i < 0) || (i >= STATS_NBINS))
+            ok = FALSE;
+         else
+            s->hist[i] = count;
+      }
+      else
+      {
+         nfields += sscanf(buffer, "offset %ld",    &(ckpt->offset));
+         nfields += sscanf(buffer, "outlen %ld",    &(ckpt->outLen));
+         nfields += sscanf(buffer, "randstate %lu", &(ckpt->randState));
+         nfields += sscanf(buffer, "headlen %ld",   &(ckpt->headLen));
+         nfields += sscanf(buffer, "headhash %lu",  &(ckpt->headHash));
+         nfields += sscanf(buffer, "mean %lf",      &(ckpt->targetMean));
+         nfields += sscanf(buffer, "sd %lf",        &(ckpt->targetSD));
+         nfields += sscanf(buffer, "valcol %d",     &(ckpt->valCol));
+         nfields += sscanf(buffer, "keycol %d",     &(ckpt->keyCol));
+         nfields += sscanf(buffer, "grouphash %lu", &(ckpt->groupHash));
+      }
+   }
+   fclose(fp);
+
+   return((BOOL)(ok && (nfields == 10) && (nstats == 1) &&
+                 (ckpt->randState != 0UL)));
+}
+
+
+/************************************************************************/
+/*>BOOL WriteCheckpoint(char *filename, CHECKPOINT *ckpt,
+                        GROUPTABLE *groups)
+   ------------------------------------------------------
+   Input:     char       *filename   Checkpoint file
+              CHECKPOINT *ckpt       Checkpoint
+              GROUPTABLE *groups     Group table (or NULL)
+   Returns:   BOOL                   Success
+
+   Writes to a temporary file and renames it so that an interrupted run
+   leaves the previous checkpoint intact. The quality statistics are
+   written in full (moments to 17 significant figures and the non-zero
+   histogram bins) so that the next run carries on from exactly where
+   this one stopped.
+
+   19.10.26  Original   By: agent
+   19.10.26  Added input identity and parameters   By: agent
+   19.10.26  Statistics replace sum and sumsq   By: agent
+   19.10.26  Added output length   By: agent
+*/
+BOOL WriteCheckpoint(char *filename, CHECKPOINT *ckpt,
+                     GROUPTABLE *groups)
+{
+   FILE  *fp;
+   GROUP *g;
+   char  tmpfile[MAXBUFF+8];
+   int   i;
+
+   sprintf(tmpfile, "%s.tmp", filename);
+   if((fp=fopen(tmpfile, "w"))==NULL)
+      return(FALSE);
+
+   fprintf(fp, "# normalize follow mode checkpoint\n");
+   fprintf(fp, "offset %ld\n",     ckpt->offset);
+   fprintf(fp, "outlen %ld\n",     ckpt->outLen);
+   fprintf(fp, "randstate %lu\n",  ckpt->randState);
+   fprintf(fp, "headlen %ld\n",    ckpt->headLen);
+   fprintf(fp, "headhash %lu\n",   ckpt->headHash);
+   fprintf(fp, "mean %.17g\n",     ckpt->targetMean);
+   fprintf(fp, "sd %.17g\n",       ckpt->targetSD);
+   fprintf(fp, "valcol %d\n",      ckpt->valCol);
+   fprintf(fp, "keycol %d\n",      ckpt->keyCol);
+   fprintf(fp, "grouphash %lu\n",  ckpt->groupHash);
+   WriteCkptStats(fp, &(ckpt->stats));
+
+   if(groups != NULL)
+   {
+      for(i=0; i<groups->ngroups; i++)
+      {
+         g = &(groups->groups[i]);
+         if(g->stats != NULL)
+         {
+            fprintf(fp, "group %s\n", g->key);
+            WriteCkptStats(fp, g->stats);
+         }
+      }
+   }
+
+   if(fclose(fp))
+      return(FALSE);
+   return((BOOL)(rename(tmpfile, filename) == 0));
+}
+
+
+/************************************************************************/
+/*>void WriteCkptStats(FILE *fp, STATS *stats)
+   -------------------------------------------
+   Input:     FILE   *fp      Checkpoint file
+              STATS  *stats   Statistics
+
+   Writes a 'stats seen n mean m2 m3' line and a 'hist bin count' line
+   for each non-empty bin
+
+   19.10.26  Original   By: agent
+*/
+void WriteCkptStats(FILE *fp, STATS *stats)
+{
+   int i;
+   
+   fprintf(fp, "stats %lu %lu %.17g %.17g %.17g\n", stats->seen,
+           stats->n, stats->mean, stats->m2, stats->m3);
+   for(i=0; i<STATS_NBINS; i++)
+   {
+      if(stats->hist[i])
+         fprintf(fp, "hist %d %lu\n", i, stats->hist[i]);
+   }
+}
+
+
+/************************************************************************/
+/*>int CheckFollowInput(FILE *in, CHECKPOINT *ckpt)
+   ------------------------------------------------
+   Input:     FILE       *in         Input file
+              CHECKPOINT *ckpt       Checkpoint
+   Returns:   int                    FOLLOW_OK, FOLLOW_SHRUNK (shorter
+                                     than the offset), FOLLOW_CHANGED
+                                     (start of file differs) or
+                                     FOLLOW_ERROR
+
+   Checks that the input is still the file the checkpoint was made from
+   and has only been appended to. Log rotation either truncates the file
+   or replaces it with a new one; without this check a run would seek
+   past the end and do nothing, or resume part way through a different
+   file. The first CKPTHEAD bytes (or fewer if that is all that has been
+   read) are hashed, so a new file is caught even if it is longer.
+
+   19.10.26  Original   By: agent
+*/
+int CheckFollowInput(FILE *in, CHECKPOINT *ckpt)
+{
+   unsigned long hash;
+   
+   if(fseek(in, 0L, SEEK_END))
+      return(FOLLOW_ERROR);
+   if(ftell(in) < ckpt->offset)
+      return(FOLLOW_SHRUNK);
+
+   if(fseek(in, 0L, SEEK_SET) || !HashHead(in, ckpt->headLen, &hash))
+      return(FOLLOW_ERROR);
+   if(hash != ckpt->headHash)
+      return(FOLLOW_CHANGED);
+
+   return(FOLLOW_OK);
+}
+
+
+/************************************************************************/
+/*>int CheckFollowOutput(char *filename, CHECKPOINT *ckpt)
+   -------------------------------------------------------
+   Input:     char       *filename   Output file
+              CHECKPOINT *ckpt       Checkpoint
+   Returns:   int                    FOLLOW_OK, FOLLOW_SHRUNK (shorter
+                                     than when the checkpoint was made)
+                                     or FOLLOW_ERROR
+
+   Output is appended before the checkpoint is rewritten, so a run that
+   fails in between leaves lines in the output that the next run will
+   write again. Anything after the length saved in the checkpoint is
+   therefore removed, leaving the output exactly as the last successful
+   run left it.
+
+   19.10.26  Original   By: agent
+*/
+int CheckFollowOutput(char *filename, CHECKPOINT *ckpt)
+{
+   long length;
+
+   if((length = FileLength(filename)) < 0L)
+      return(FOLLOW_ERROR);
+   if(length < ckpt->outLen)
+      return(FOLLOW_SHRUNK);
+   if((length > ckpt->outLen) && !TruncateFile(filename, ckpt->outLen))
+      return(FOLLOW_ERROR);
+   return(FOLLOW_OK);
+}
+
+
+/************************************************************************/
+/*>long FileLength(char *filename)
+   -------------------------------
+   Input:     char   *filename   File
+   Returns:   long               Length in bytes (0 if the file does not
+                                 exist, -1 on error)
+
+   19.10.26  Original   By: agent
+*/
+long FileLength(char *filename)
+{
+   FILE *fp;
+   long length;
+
+   if((fp=fopen(filename, "rb"))==NULL)
+      return(0L);
+   if(fseek(fp, 0L, SEEK_END))
+      length = (-1L);
+   else
+      length = ftell(fp);
+   fclose(fp);
+   return(length);
 }
 
 
+/************************************************************************/
+/*>BOOL TruncateFile(char *filename, long length)
+   ----------------------------------------------
+   Input:     char   *filename   File
+              long   length      Bytes to keep
+   Returns:   BOOL               Success
+
+   ANSI C has no truncate(), so the first length bytes are copied to a
+   temporary file which is renamed over the original. This is only
+   needed after a failed run so the cost of the copy does not matter.
+
+   19.10.26  Original   By: agent
+*/
+BOOL TruncateFile(char *filename, long length)
+{
+   FILE   *in,
+          *out;
+   char   tmpfile[MAXBUFF+8],
+          buffer[MAXBUFF];
+   size_t n;
+   BOOL   ok = TRUE;
 
+   sprintf(tmpfile, "%s.tmp", filename);
+   if((in=fopen(filename, "rb"))==NULL)
+      return(FALSE);
+   if((out=fopen(tmpfile, "wb"))==NULL)
+   {
+      fclose(in);
+      return(FALSE);
+   }
+
+   while(ok && (length > 0L))
+   {
+      n = (size_t)MIN(length, (long)MAXBUFF);
+      if((fread(buffer, 1, n, in) != n) ||
+         (fwrite(buffer, 1, n, out) != n))
+         ok = FALSE;
+      length -= (long)n;
+   }
+   fclose(in);
+   if(fclose(out))
+      ok = FALSE;
+
+   if(ok)
+      ok = (BOOL)(rename(tmpfile, filename) == 0);
+   else
+      remove(tmpfile);
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL HashHead(FILE *in, long nbytes, unsigned long *hash)
+   ---------------------------------------------------------
+   Input:     FILE          *in      File positioned at the start
+              long          nbytes   Bytes to hash (-1 = all)
+   Output:    unsigned long *hash    32-bit FNV-1a hash (as HashKey())
+   Returns:   BOOL                   Success (FALSE if fewer than
+                                     nbytes could be read)
+
+   19.10.26  Original   By: agent
+*/
+BOOL HashHead(FILE *in, long nbytes, unsigned long *hash)
+{
+   int  c;
+   long n;
+
+   *hash = 2166136261UL;
+   for(n=0; (nbytes < 0) || (n < nbytes); n++)
+   {
+      if((c = getc(in)) == EOF)
+         return((BOOL)((nbytes < 0) && !ferror(in)));
+      *hash ^= (unsigned long)c;
+      *hash  = (*hash * 16777619UL) & 0xFFFFFFFFUL;
+   }
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>char *GetField(char *buffer, int field, char *word, int maxlen)
+   ---------------------------------------------------------------
+   Input:     char   *buffer   Line of input
+              int    field     Field number (from 1)
+              int    maxlen    Size of word
+   Output:    char   *word     The field
+   Returns:   char   *         word, or NULL if there are fewer fields
+
+   Extracts a whitespace-separated field from a line
+
+   19.10.26  Original   By: agent
+*/
+char *GetField(char *buffer, int field, char *word, int maxlen)
+{
+   char *chp = buffer;
+   int  i;
+
+   for(;;)
+   {
+      while((*chp == ' ') || (*chp == '\t'))
+         chp++;
+      if(*chp == '\0')
+         return(NULL);
+
+      if(--field == 0)
+         break;
+      
+      while(*chp && (*chp != ' ') && (*chp != '\t'))
+         chp++;
+   }
+
+   for(i=0; (i<maxlen-1) && *chp && (*chp != ' ') && (*chp != '\t'); i++)
+      word[i] = *(chp++);
+   word[i] = '\0';
+
+   return(word);
+}
+
+
+/************************************************************************/
+/*>GROUPTABLE *CreateGroupTable(void)
+   ----------------------------------
+   Returns:   GROUPTABLE *    Empty group table (NULL if no memory)
+
+   19.10.26  Original   By: agent
+*/
+GROUPTABLE *CreateGroupTable(void)
+{
+   GROUPTABLE *table;
+   int        i;
+
+   if((table = (GROUPTABLE *)malloc(sizeof(GROUPTABLE)))==NULL)
+      return(NULL);
+
+   table->nslots    = MINSLOTS;
+   table->maxgroups = MINSLOTS / 2;
+   table->ngroups   = 0;
+   table->slots     = (int *)malloc(table->nslots * sizeof(int));
+   table->groups    = (GROUP *)malloc(table->maxgroups * sizeof(GROUP));
+   if((table->slots == NULL) || (table->groups == NULL))
+   {
+      FreeGroupTable(table);
+      return(NULL);
+   }
+
+   for(i=0; i<table->nslots; i++)
+      table->slots[i] = (-1);
+   
+   return(table);
+}
+
+
+/************************************************************************/
+/*>void FreeGroupTable(GROUPTABLE *table)
+   --------------------------------------
+   Input:     GROUPTABLE *table    Group table to free
+
+   19.10.26  Original   By: agent
+*/
+void FreeGroupTable(GROUPTABLE *table)
+{
+   int i;
+   
+   if(table == NULL)
+      return;
+   
+   if(table->groups != NULL)
+   {
+      for(i=0; i<table->ngroups; i++)
+      {
+         free(table->groups[i].key);
+         if(table->groups[i].stats != NULL)
+            free(table->groups[i].stats);
+      }
+      free(table->groups);
+   }
+   if(table->slots != NULL)
+      free(table->slots);
+   free(table);
+}
+
+
+/************************************************************************/
+/*>unsigned long HashKey(char *key)
+   --------------------------------
+   Input:     char   *key     Key string
+   Returns:   unsigned long   32-bit FNV-1a hash of the key
+
+   19.10.26  Original   By: agent
+*/
+unsigned long HashKey(char *key)
+{
+   unsigned long hash = 2166136261UL;
+
+   while(*key)
+   {
+      hash ^= (unsigned long)(unsigned char)(*key++);
+      hash  = (hash * 16777619UL) & 0xFFFFFFFFUL;
+   }
+   return(hash);
+}
+
+
+/************************************************************************/
+/*>int FindGroup(GROUPTABLE *table, char *key)
+   -------------------------------------------
+   Input:     GROUPTABLE *table    Group table
+              char       *key      Key to find
+   Returns:   int                  Slot holding the key, or the empty
+                                   slot where it would be inserted
+
+   Linear probing. The table is never more than half full so there is
+   always an empty slot to stop the search.
+
+   19.10.26  Original   By: agent
+*/
+int FindGroup(GROUPTABLE *table, char *key)
+{
+   int slot, 
+       mask = table->nslots - 1;
+
+   slot = (int)(HashKey(key) & (unsigned long)mask);
+   while((table->slots[slot] >= 0) &&
+         strcmp(table->groups[table->slots[slot]].key, key))
+   {
+      slot = (slot + 1) & mask;
+   }
+   return(slot);
+}
+
+
+/************************************************************************/
+/*>int InternGroup(GROUPTABLE *table, char *key, REAL mean, REAL sd)
+   -----------------------------------------------------------------
+   Input:     char       *key      Key to intern
+              REAL       mean      Target mean if the key is new
+              REAL       sd        Target SD if the key is new
+   I/O:       GROUPTABLE *table    Group table
+   Returns:   int                  Group index (-1 if no memory)
+
+   Returns the index of an existing group, or adds a new one with the
+   specified target.
+
+   19.10.26  Original   By: agent
+*/
+int InternGroup(GROUPTABLE *table, char *key, REAL mean, REAL sd)
+{
+   GROUP *g;
+   int   slot;
+
+   slot = FindGroup(table, key);
+   if(table->slots[slot] >= 0)
+      return(table->slots[slot]);
+
+   if(table->ngroups == table->maxgroups)
+   {
+      if(!GrowGroupTable(table))
+         return(-1);
+      slot = FindGroup(table, key);
+   }
+
+   g = &(table->groups[table->ngroups]);
+   if((g->key = (char *)malloc(strlen(key)+1))==NULL)
+      return(-1);
+   strcpy(g->key, key);
+   g->mean = mean;
+   g->sd   = sd;
+   g->head  = g->tail = NULL;
+   g->stats = NULL;
+   
+   table->slots[slot] = table->ngroups;
+   return(table->ngroups++);
+}
+
+
+/************************************************************************/
+/*>BOOL GrowGroupTable(GROUPTABLE *table)
+   --------------------------------------
+   I/O:       GROUPTABLE *table    Group table
+   Returns:   BOOL                 Success
+
+   Doubles the number of slots and rehashes the existing keys
+
+   19.10.26  Original   By: agent
+*/
+BOOL GrowGroupTable(GROUPTABLE *table)
+{
+   GROUP *groups;
+   int   *slots,
+         i;
+
+   if((groups = (GROUP *)realloc(table->groups, 
+                                 2 * table->maxgroups * sizeof(GROUP)))
+      == NULL)
+      return(FALSE);
+   table->groups = groups;
+   
+   if((slots = (int *)malloc(2 * table->nslots * sizeof(int)))==NULL)
+      return(FALSE);
+   free(table->slots);
+   table->slots      = slots;
+   table->nslots    *= 2;
+   table->maxgroups *= 2;
+
+   for(i=0; i<table->nslots; i++)
+      table->slots[i] = (-1);
+   for(i=0; i<table->ngroups; i++)
+      table->slots[FindGroup(table, table->groups[i].key)] = i;
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadGroupTable(FILE *fp, GROUPTABLE *table)
+   ------------------------------------------------
+   Input:     FILE       *fp       File of 'key mean sd' lines
+   I/O:       GROUPTABLE *table    Group table
+   Returns:   BOOL                 Success
+
+   Blank lines and lines starting with # are ignored. A repeated key
+   takes the last target given.
+
+   19.10.26  Original   By: agent
+*/
+BOOL ReadGroupTable(FILE *fp, GROUPTABLE *table)
+{
+   char buffer[MAXBUFF],
+        key[MAXBUFF];
+   REAL mean, sd;
+   int  g;
+   
+   while(fgets(buffer, MAXBUFF, fp))
+   {
+      TERMINATE(buffer);
+      if((GetField(buffer, 1, key, MAXBUFF) == NULL) || (key[0] == '#'))
+         continue;
+      
+      if((sscanf(buffer, "%*s %lf %lf", &mean, &sd) != 2) || (sd <= 0.0))
+         return(FALSE);
+
+      if((g = InternGroup(table, key, mean, sd)) < 0)
+         return(FALSE);
+      table->groups[g].mean = mean;
+      table->groups[g].sd   = sd;
+   }
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>REAL CalcProbability(REAL z)
+   ----------------------------
+   Input:     
+   Output:    
+   Returns:   
+
+   24.07.09  Original   By: ACRM
+*/
+REAL CalcProbability(REAL z)
+{
+   REAL p;
+   p = (1+erff((double)(-z/sqrt(2))));
+   return(p);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadModel(FILE *fp, MVMODEL *model)
+   ----------------------------------------
+   Input:     FILE    *fp      Model file
+   Output:    MVMODEL *model   Model - mean and Cholesky factor
+   Returns:   BOOL             Success
+
+   Reads the mean vector (the first line, which defines d) then d lines
+   of the covariance matrix. Blank lines and lines starting with # are
+   ignored. The matrix must be symmetric and positive definite.
+
+   19.10.26  Original   By: agent
+*/
+BOOL ReadModel(FILE *fp, MVMODEL *model)
+{
+   REAL cov[MAXDIM][MAXDIM],
+        *row;
+   char buffer[MAXBUFF],
+        *chp,
+        *end;
+   int  nrows = -1,
+        n,
+        i, j;
+
+   model->ndim = 0;
+   
+   while(fgets(buffer, MAXBUFF, fp))
+   {
+      TERMINATE(buffer);
+      for(chp=buffer; (*chp == ' ') || (*chp == '\t'); chp++);
+      if((*chp == '\0') || (*chp == '#'))
+         continue;
+
+      if(nrows == model->ndim)
+         return(FALSE);
+      row = (nrows < 0) ? model->mean : cov[nrows];
+      
+      for(n=0; ; n++)
+      {
+         REAL val = (REAL)strtod(chp, &end);
+         if(end == chp)
+            break;
+         if(n == MAXDIM)
+            return(FALSE);
+         row[n] = val;
+         chp    = end;
+      }
+
+      if(nrows < 0)
+         model->ndim = n;
+      else if(n != model->ndim)
+         return(FALSE);
+      nrows++;
+   }
+
+   if((model->ndim == 0) || (nrows != model->ndim))
+      return(FALSE);
+
+   for(i=0; i<model->ndim; i++)
+   {
+      for(j=0; j<i; j++)
+      {
+         if(ABS(cov[i][j] - cov[j][i]) > 
+            1.0e-9 * (ABS(cov[i][j]) + ABS(cov[j][i])))
+            return(FALSE);
+      }
+   }
+   
+   return(CholeskyDecompose(cov, model));
+}
+
+
+/************************************************************************/
+/*>BOOL CholeskyDecompose(REAL cov[MAXDIM][MAXDIM], MVMODEL *model)
+   ----------------------------------------------------------------
+   Input:     REAL    cov[][]  Covariance matrix (lower triangle used)
+   I/O:       MVMODEL *model   ndim must be set. On return chol holds L
+                               where cov = L L^T, and invDiag 1/L[i][i]
+   Returns:   BOOL             Success (FALSE if not positive definite)
+
+   19.10.26  Original   By: agent
+*/
+BOOL CholeskyDecompose(REAL cov[MAXDIM][MAXDIM], MVMODEL *model)
+{
+   REAL sum;
+   int  i, j, k;
+
+   for(i=0; i<model->ndim; i++)
+   {
+      for(j=0; j<=i; j++)
+      {
+         sum = cov[i][j];
+         for(k=0; k<j; k++)
+            sum -= model->chol[i][k] * model->chol[j][k];
+
+         if(i == j)
+         {
+            if(sum <= (REAL)0.0)
+               return(FALSE);
+            model->chol[i][i]  = sqrt(sum);
+            model->invDiag[i]  = (REAL)1.0 / model->chol[i][i];
+         }
+         else
+         {
+            model->chol[i][j]  = sum * model->invDiag[j];
+         }
+      }
+      for(j=i+1; j<model->ndim; j++)
+         model->chol[i][j] = (REAL)0.0;
+   }
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL NormalizeMultiData(FILE *in, FILE *out, MVMODEL *model,
+                           STATS *stats)
+   ------------------------------------------------------------
+   Input:     FILE    *in      Input file
+              FILE    *out     Output file
+              MVMODEL *model   Model
+   I/O:       STATS   *stats   Quality statistics of D^2 (or NULL)
+   Returns:   BOOL             Success (FALSE if no memory)
+
+   Streams the input in blocks of BLOCKSIZE records. Each line is split
+   once, scattering the wanted columns into a structure-of-arrays block
+   (block[dim*BLOCKSIZE + record]); the block is then passed through
+   MahalanobisBlock() and ChiSqTailBatch() before one random number per
+   record, in input order, decides which lines are written. Missing
+   values are taken as zero as in the 1-D case.
+
+   19.10.26  Original   By: agent
+   19.10.26  Added stats   By: agent
+*/
+BOOL NormalizeMultiData(FILE *in, FILE *out, MVMODEL *model,
+                        STATS *stats)
+{
+   REAL *block,
+        *d2,
+        *p;
+   char *lines,
+        *chp,
+        *end;
+   int  slot[MAXCOLS+1],
+        ndim = model->ndim,
+        n    = 0,
+        field,
+        i, b;
+   BOOL eof = FALSE;
+
+   block = (REAL *)malloc(ndim * BLOCKSIZE * sizeof(REAL));
+   d2    = (REAL *)malloc(BLOCKSIZE * sizeof(REAL));
+   p     = (REAL *)malloc(BLOCKSIZE * sizeof(REAL));
+   lines = (char *)malloc(BLOCKSIZE * MAXBUFF);
+   if((block == NULL) || (d2 == NULL) || (p == NULL) || (lines == NULL))
+   {
+      if(block != NULL) free(block);
+      if(d2    != NULL) free(d2);
+      if(p     != NULL) free(p);
+      if(lines != NULL) free(lines);
+      return(FALSE);
+   }
+
+   /* slot[field] is the dimension taken from that field, or -1         */
+   for(i=0; i<=MAXCOLS; i++)
+      slot[i] = (-1);
+   for(i=0; i<ndim; i++)
+      slot[model->cols[i]] = i;
+
+   while(!eof)
+   {
+      /* Fill a block                                                   */
+      for(n=0; n<BLOCKSIZE; n++)
+      {
+         chp = lines + n*MAXBUFF;
+         if(!fgets(chp, MAXBUFF, in))
+         {
+            eof = TRUE;
+            break;
+         }
+         TERMINATE(chp);
+
+         for(i=0; i<ndim; i++)
+            block[i*BLOCKSIZE + n] = (REAL)0.0;
+         for(field=1; field<=MAXCOLS; field++)
+         {
+            while((*chp == ' ') || (*chp == '\t'))
+               chp++;
+            if(*chp == '\0')
+               break;
+            if(slot[field] >= 0)
+               block[slot[field]*BLOCKSIZE + n] = (REAL)strtod(chp, &end);
+            while(*chp && (*chp != ' ') && (*chp != '\t'))
+               chp++;
+         }
+      }
+
+      /* Score and select it                                            */
+      MahalanobisBlock(model, block, d2, n);
+      ChiSqTailBatch(ndim, d2, p, n);
+      for(b=0; b<n; b++)
+      {
+         if(p[b] >= RandomNumber((REAL)1.0))
+         {
+            fprintf(out, "%s\n", lines + b*MAXBUFF);
+            if(stats != NULL)
+               AddStats(stats, d2[b], (REAL)1.0 - p[b]);
+         }
+      }
+      if(stats != NULL)
+         stats->seen += n;
+   }
+
+   free(block);
+   free(d2);
+   free(p);
+   free(lines);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void MahalanobisBlock(MVMODEL *model, REAL *block, REAL *d2, int n)
+   -------------------------------------------------------------------
+   Input:     MVMODEL *model   Model
+              int     n        Number of records in the block
+   I/O:       REAL    *block   Structure-of-arrays block of n records
+                               (stride BLOCKSIZE). Overwritten by the
+                               whitened vectors y.
+   Output:    REAL    *d2      Squared Mahalanobis distance per record
+
+   Solves L y = x - mu by forward substitution, one dimension at a time
+   across the whole block, accumulating |y|^2. Every inner loop runs
+   over records with unit stride and no dependencies between iterations
+   so it vectorizes.
+
+   19.10.26  Original   By: agent
+*/
+void MahalanobisBlock(MVMODEL *model, REAL *block, REAL *d2, int n)
+{
+   REAL *yi, *yj,
+        mu, lij, inv;
+   int  i, j, b;
+
+   for(b=0; b<n; b++)
+      d2[b] = (REAL)0.0;
+
+   for(i=0; i<model->ndim; i++)
+   {
+      yi  = block + i*BLOCKSIZE;
+      mu  = model->mean[i];
+      for(b=0; b<n; b++)
+         yi[b] -= mu;
+
+      for(j=0; j<i; j++)
+      {
+         yj  = block + j*BLOCKSIZE;
+         lij = model->chol[i][j];
+         for(b=0; b<n; b++)
+            yi[b] -= lij * yj[b];
+      }
+
+      inv = model->invDiag[i];
+      for(b=0; b<n; b++)
+      {
+         yi[b] *= inv;
+         d2[b] += yi[b] * yi[b];
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>void ChiSqTailBatch(int ndim, REAL *d2, REAL *p, int n)
+   -------------------------------------------------------
+   Input:     int   ndim    Degrees of freedom
+              REAL  *d2     Chi-squared values
+              int   n       Number of values
+   Output:    REAL  *p      Upper tail probabilities Q(ndim/2, d2/2)
+
+   Uses the finite series for integer degrees of freedom (see the
+   description at the top of the file) rather than the iterative
+   incomplete gamma function: one exp(), plus one erfcc() for odd ndim,
+   and ndim/2 multiply-adds per value.
+
+   19.10.26  Original   By: agent
+*/
+void ChiSqTailBatch(int ndim, REAL *d2, REAL *p, int n)
+{
+   REAL h, term, sum, e;
+   int  b, k;
+
+   if(ndim % 2)
+   {
+      for(b=0; b<n; b++)
+      {
+         h    = d2[b] / (REAL)2.0;
+         e    = exp(-h);
+         term = sqrt(h) * (REAL)1.1283791670955126; /* h^.5/Gamma(1.5) */
+         sum  = (REAL)0.0;
+         for(k=1; k<=(ndim-1)/2; k++)
+         {
+            sum  += term;
+            term *= h / (k + (REAL)0.5);
+         }
+         p[b] = erfcc(sqrt(h)) + e * sum;
+      }
+   }
+   else
+   {
+      for(b=0; b<n; b++)
+      {
+         h    = d2[b] / (REAL)2.0;
+         term = (REAL)1.0;
+         sum  = (REAL)0.0;
+         for(k=0; k<ndim/2; k++)
+         {
+            sum  += term;
+            term *= h / (k + 1);
+         }
+         p[b] = exp(-h) * sum;
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL NormalizeColumn(FILE *out, COLUMN *col, unsigned long nrows,
+                        REAL targetMean, REAL targetSD, BOOL indexOut,
+                        STATS *stats, unsigned long memLimit)
+   --------------------------------------------------------------------
+   Input:     FILE          *out        Output file
+              COLUMN        *col        Mapped f8 or f4 value column
+              unsigned long nrows       Number of rows
+              REAL          targetMean  Target mean
+              REAL          targetSD    Target standard deviation
+              BOOL          indexOut    Write selected row numbers
+                                        rather than a flag per row
+              unsigned long memLimit    Memory limit (0 = none)
+   I/O:       STATS         *stats      Quality statistics (or NULL)
+   Returns:   BOOL                      Success
+
+   Reads the values in place from the mapping. Rows are processed in
+   chunks (all of them at once unless there is a memory limit), each
+   building a one byte flag per row. Flags are written straight after
+   the header since the row count is known. Row numbers are compacted
+   from the flags; if there is more than one chunk they are spilled to
+   a temporary file until the total is known for the header.
+
+   19.10.26  Original   By: agent
+   19.10.26  Added stats   By: agent
+   19.10.26  Processes in chunks for memLimit   By: agent
+*/
+BOOL NormalizeColumn(FILE *out, COLUMN *col, unsigned long nrows,
+                     REAL targetMean, REAL targetSD, BOOL indexOut,
+                     STATS *stats, unsigned long memLimit)
+{
+   const double  *f8 = NULL;
+   const float   *f4 = NULL;
+   unsigned char *selected;
+   UINT32        *index  = NULL;
+   FILE          *spill  = NULL;
+   unsigned long i,
+                 start,
+                 chunk   = nrows,
+                 n,
+                 m,
+                 nselected = 0;
+   char          *name = "index",
+                 *type = "u4";
+   REAL          value;
+   BOOL          ok = TRUE;
+
+   if(indexOut && (nrows > 0xFFFFFFFFUL))
+      return(FALSE);
+
+   if(!strcmp(col->type, "f8"))
+      f8 = (const double *)col->data;
+   else
+      f4 = (const float *)col->data;
+
+   /* Each row needs a flag and, for index output, a row number         */
+   if(memLimit)
+      chunk = MIN(nrows, memLimit / (indexOut ? 1+sizeof(UINT32) : 1));
+   if(chunk == 0)
+      chunk = 1;
+
+   selected = (unsigned char *)malloc(chunk);
+   if(indexOut)
+      index = (UINT32 *)malloc(chunk * sizeof(UINT32));
+   if((selected == NULL) || (indexOut && (index == NULL)))
+   {
+      if(selected != NULL) free(selected);
+      if(index    != NULL) free(index);
+      return(FALSE);
+   }
+
+   if(!indexOut)
+   {
+      name = "selected";
+      type = "u1";
+      ok   = (BOOL)WriteColHeader(out, 1, &name, &type, nrows);
+   }
+   else if(nrows == 0)
+   {
+      ok   = (BOOL)WriteColHeader(out, 1, &name, &type, 0UL);
+   }
+   
+   for(start=0; ok && (start<nrows); start+=n)
+   {
+      n = MIN(chunk, nrows-start);
+      for(i=0; i<n; i++)
+      {
+         value       = (f8 != NULL) ? (REAL)f8[start+i] : 
+                                      (REAL)f4[start+i];
+         selected[i] = (unsigned char)SelectValue(value, targetMean,
+                                                  targetSD);
+         if((stats != NULL) && selected[i])
+            AddStats(stats, value, 
+                     NormalCDF((value-targetMean)/targetSD));
+      }
+      if(stats != NULL)
+         stats->seen += n;
+
+      if(!indexOut)
+      {
+         ok = (BOOL)(fwrite(selected, 1, n, out) == n);
+         continue;
+      }
+
+      for(i=0, m=0; i<n; i++)
+      {
+         if(selected[i])
+            index[m++] = (UINT32)(start+i);
+      }
+      nselected += m;
+
+      if((start+n == nrows) && (spill == NULL))
+      {
+         /* Everything was in one chunk so there is no need to spill    */
+         ok = (BOOL)(WriteColHeader(out, 1, &name, &type, nselected) &&
+                     (fwrite(index, sizeof(UINT32), m, out) == m));
+      }
+      else if((spill == NULL) && ((spill = tmpfile()) == NULL))
+      {
+         ok = FALSE;
+      }
+      else
+      {
+         ok = (BOOL)(fwrite(index, sizeof(UINT32), m, spill) == m);
+      }
+   }
+
+   /* Copy spilled row numbers after the header                         */
+   if(spill != NULL)
+   {
+      if(ok)
+      {
+         ok = (BOOL)WriteColHeader(out, 1, &name, &type, nselected);
+         rewind(spill);
+         while(ok && 
+               ((m = fread(index, sizeof(UINT32), chunk, spill)) > 0))
+            ok = (BOOL)(fwrite(index, sizeof(UINT32), m, out) == m);
+         if(ferror(spill))
+            ok = FALSE;
+      }
+      fclose(spill);
+   }
+
+   free(selected);
+   if(index != NULL)
+      free(index);
+   return((BOOL)(ok && (fflush(out) == 0)));
+}
+
+
+/************************************************************************/
+/*>BOOL ParseSize(char *string, unsigned long *size)
+   -------------------------------------------------
+   Input:     char          *string   Size, optionally followed by k, M
+                                      or G (powers of 1024)
+   Output:    unsigned long *size     Size in bytes
+   Returns:   BOOL                    Valid and at least MINMEMLIMIT
+
+   19.10.26  Original   By: agent
+*/
+BOOL ParseSize(char *string, unsigned long *size)
+{
+   double value;
+   char   suffix = '\0';
+
+   if(sscanf(string, "%lf%c", &value, &suffix) < 1)
+      return(FALSE);
+
+   switch(suffix)
+   {
+   case 'g': case 'G':
+      value *= 1024.0;
+      /* Fall through                                                   */
+   case 'm': case 'M':
+      value *= 1024.0;
+      /* Fall through                                                   */
+   case 'k': case 'K':
+      value *= 1024.0;
+      /* Fall through                                                   */
+   case '\0':
+      break;
+   default:
+      return(FALSE);
+   }
+
+   if((value < (double)MINMEMLIMIT) || (value > (double)(~0UL)))
+      return(FALSE);
+   *size = (unsigned long)value;
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL StreamData(FILE *in, FILE *out, int valCol, int keyCol,
+                   GROUPTABLE *groups, REAL targetMean, REAL targetSD,
+                   STATS *stats)
+   ------------------------------------------------------------------
+   Input:     FILE       *in         Input file
+              FILE       *out        Output file
+              int        valCol      Column containing the value (from 1)
+              int        keyCol      Column containing the key (0=none)
+              REAL       targetMean  Target mean
+              REAL       targetSD    Target standard deviation
+   I/O:       GROUPTABLE *groups     Group table (or NULL)
+              STATS      *stats      Quality statistics (or NULL)
+   Returns:   BOOL                   Success
+
+   Equivalent to ReadData(), NormalizeData() and PrintData(), but holds
+   only one record at a time.
+
+   19.10.26  Original   By: agent
+*/
+BOOL StreamData(FILE *in, FILE *out, int valCol, int keyCol,
+                GROUPTABLE *groups, REAL targetMean, REAL targetSD,
+                STATS *stats)
+{
+   REALLIST rec;
+   char     buffer[MAXBUFF];
+   BOOL     accepted;
+
+   while(fgets(buffer, MAXBUFF, in))
+   {
+      TERMINATE(buffer);
+      if(!ParseRecord(buffer, &rec, valCol, keyCol, groups,
+                      targetMean, targetSD))
+         return(FALSE);
+
+      accepted = SelectRecord(&rec, targetMean, targetSD, groups);
+      if((stats != NULL) &&
+         !AccumulateRecord(&rec, accepted, targetMean, targetSD, groups,
+                           stats))
+         return(FALSE);
+
+      if(accepted)
+         fprintf(out, "%s\n", rec.data);
+   }
+   return((BOOL)(!ferror(in) && !fflush(out)));
+}
+
+
+/************************************************************************/
+/*>BOOL StreamGroupData(FILE *in, char *prefix, int valCol, int keyCol,
+                        GROUPTABLE *groups, REAL targetMean, 
+                        REAL targetSD, STATS *stats, 
+                        unsigned long memLimit, long *nokey)
+   --------------------------------------------------------------------
+   Input:     FILE          *in         Input file
+              char          *prefix     Output filename prefix
+              int           valCol      Column containing the value
+              int           keyCol      Column containing the key
+              REAL          targetMean  Default target mean
+              REAL          targetSD    Default target SD
+              unsigned long memLimit    Memory limit
+   I/O:       GROUPTABLE    *groups     Group table
+              STATS         *stats      Quality statistics (or NULL)
+   Output:    long          *nokey      Number of records with no key
+   Returns:   BOOL                      Success
+
+   The bounded memory version of PrintGroupData(). Accepted records are
+   packed into a buffer (a quarter of memLimit for the RUNREC index, the
+   rest for text). Each time it fills it is sorted by group and spilled
+   as a run, then the runs are merged into the group files.
+
+   19.10.26  Original   By: agent
+   19.10.26  Uses a RUNSET for multi-level merging   By: agent
+   19.10.26  Counts records with no key   By: agent
+*/
+BOOL StreamGroupData(FILE *in, char *prefix, int valCol, int keyCol,
+                     GROUPTABLE *groups, REAL targetMean, REAL targetSD,
+                     STATS *stats, unsigned long memLimit, long *nokey)
+{
+   REALLIST      rec;
+   RUNREC        *recs;
+   RUNSET        runs;
+   char          buffer[MAXBUFF],
+                 *arena;
+   unsigned long arenaSize,
+                 used  = 0,
+                 len;
+   int           maxRecs,
+                 nrecs = 0,
+                 i;
+   BOOL          accepted,
+                 ok = TRUE;
+
+   *nokey = 0L;
+   for(i=0; i<MAXLEVELS; i++)
+      runs.nruns[i] = 0;
+
+   maxRecs   = (int)MIN(memLimit / 4 / sizeof(RUNREC), 0x7FFFFFFFUL);
+   arenaSize = memLimit - maxRecs * sizeof(RUNREC);
+   recs      = (RUNREC *)malloc(maxRecs * sizeof(RUNREC));
+   arena     = (char *)malloc(arenaSize);
+   if((recs == NULL) || (arena == NULL))
+   {
+      if(recs  != NULL) free(recs);
+      if(arena != NULL) free(arena);
+      return(FALSE);
+   }
+
+   while(ok && fgets(buffer, MAXBUFF, in))
+   {
+      TERMINATE(buffer);
+      if(!ParseRecord(buffer, &rec, valCol, keyCol, groups,
+                      targetMean, targetSD))
+      {
+         ok = FALSE;
+         break;
+      }
+
+      accepted = SelectRecord(&rec, targetMean, targetSD, groups);
+      if((stats != NULL) &&
+         !AccumulateRecord(&rec, accepted, targetMean, targetSD, groups,
+                           stats))
+      {
+         ok = FALSE;
+         break;
+      }
+      if(!accepted)
+         continue;
+      if(rec.group < 0)
+      {
+         (*nokey)++;
+         continue;
+      }
+
+      len = strlen(rec.data);
+      if((nrecs == maxRecs) || (used + len > arenaSize))
+      {
+         ok    = SpillRun(recs, nrecs, &runs);
+         nrecs = 0;
+         used  = 0;
+      }
+      recs[nrecs].group = rec.group;
+      recs[nrecs].len   = (int)len;
+      recs[nrecs].text  = arena + used;
+      memcpy(arena + used, rec.data, len);
+      used += len;
+      nrecs++;
+   }
+   if(ferror(in))
+      ok = FALSE;
+
+   if(ok && nrecs)
+      ok = SpillRun(recs, nrecs, &runs);
+   free(recs);
+   free(arena);
+
+   if(ok)
+      ok = FinishRuns(&runs, prefix, groups);
+   CloseRuns(&runs);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>int CompareRunRecs(const void *a, const void *b)
+   ------------------------------------------------
+   qsort() comparison: by group then by position in the buffer, which
+   is input order, making the sort stable.
+
+   19.10.26  Original   By: agent
+*/
+int CompareRunRecs(const void *a, const void *b)
+{
+   const RUNREC *ra = (const RUNREC *)a,
+                *rb = (const RUNREC *)b;
+
+   if(ra->group != rb->group)
+      return((ra->group < rb->group) ? -1 : 1);
+   if(ra->text != rb->text)
+      return((ra->text < rb->text) ? -1 : 1);
+   return(0);
+}
+
+
+/************************************************************************/
+/*>BOOL SpillRun(RUNREC *recs, int nrecs, RUNSET *runs)
+   ------------------------------------------------------
+   Input:     RUNREC *recs     Buffered records
+              int    nrecs     Number of records
+   I/O:       RUNSET *runs     Run files
+   Returns:   BOOL             Success
+
+   Sorts the buffer and writes it to a new temporary file as a run of
+   (group, length, text) records at level 0.
+
+   19.10.26  Original   By: agent
+   19.10.26  Adds to a RUNSET rather than collapsing all runs   By: agent
+*/
+BOOL SpillRun(RUNREC *recs, int nrecs, RUNSET *runs)
+{
+   FILE *fp;
+   int  i;
+
+   qsort(recs, nrecs, sizeof(RUNREC), CompareRunRecs);
+
+   if((fp = tmpfile()) == NULL)
+      return(FALSE);
+   for(i=0; i<nrecs; i++)
+   {
+      if((fwrite(&(recs[i].group), sizeof(int), 1, fp) != 1) ||
+         (fwrite(&(recs[i].len),   sizeof(int), 1, fp) != 1) ||
+         (fwrite(recs[i].text, 1, recs[i].len, fp) != 
+          (size_t)recs[i].len))
+      {
+         fclose(fp);
+         return(FALSE);
+      }
+   }
+   return(AddRun(runs, 0, fp));
+}
+
+
+/************************************************************************/
+/*>BOOL AddRun(RUNSET *runs, int level, FILE *fp)
+   ----------------------------------------------
+   Input:     int    level    Level to add the run at
+              FILE   *fp      Run file (newest so far)
+   I/O:       RUNSET *runs    Run files
+   Returns:   BOOL            Success
+
+   Adds a run at a level. When that fills the level, its MAXRUNS runs
+   are merged into one run which is added at the next level up. A level
+   only ever holds runs of roughly the same size, so each record is
+   copied once per level rather than at every merge. On failure the
+   files are left in runs for CloseRuns(), except that fp is closed if
+   there are no levels left.
+
+   19.10.26  Original   By: agent
+*/
+BOOL AddRun(RUNSET *runs, int level, FILE *fp)
+{
+   FILE *merged;
+   int  i;
+
+   if(level >= MAXLEVELS)
+   {
+      fclose(fp);
+      return(FALSE);
+   }
+   runs->runs[level][runs->nruns[level]++] = fp;
+   if(runs->nruns[level] < MAXRUNS)
+      return(TRUE);
+
+   if((merged = tmpfile()) == NULL)
+      return(FALSE);
+   if(!MergeRuns(runs->runs[level], MAXRUNS, merged, NULL, NULL))
+   {
+      fclose(merged);
+      return(FALSE);
+   }
+   for(i=0; i<MAXRUNS; i++)
+      fclose(runs->runs[level][i]);
+   runs->nruns[level] = 0;
+
+   return(AddRun(runs, level+1, merged));
+}
+
+
+/************************************************************************/
+/*>BOOL FinishRuns(RUNSET *runs, char *prefix, GROUPTABLE *groups)
+   ---------------------------------------------------------------
+   Input:     char       *prefix  Group file prefix
+              GROUPTABLE *groups  Group table
+   I/O:       RUNSET     *runs    Run files
+   Returns:   BOOL                Success
+
+   Writes the group files with one final merge of every run, oldest
+   (highest level) first so that ties keep input order. If there are
+   more than MAXRUNS runs in all, the lowest levels, which hold the
+   least data, are first merged into their next level up.
+
+   19.10.26  Original   By: agent
+*/
+BOOL FinishRuns(RUNSET *runs, char *prefix, GROUPTABLE *groups)
+{
+   FILE *all[MAXRUNS],
+        *fp;
+   int  level,
+        total,
+        n,
+        i;
+
+   for(level=0; level<MAXLEVELS-1; level++)
+   {
+      for(i=0, total=0; i<MAXLEVELS; i++)
+         total += runs->nruns[i];
+      if(total <= MAXRUNS)
+         break;
+      if((n = runs->nruns[level]) == 0)
+         continue;
+
+      if(n == 1)
+      {
+         fp = runs->runs[level][0];
+      }
+      else
+      {
+         if((fp = tmpfile()) == NULL)
+            return(FALSE);
+         if(!MergeRuns(runs->runs[level], n, fp, NULL, NULL))
+         {
+            fclose(fp);
+            return(FALSE);
+         }
+         for(i=0; i<n; i++)
+            fclose(runs->runs[level][i]);
+      }
+      runs->nruns[level] = 0;
+      if(!AddRun(runs, level+1, fp))
+         return(FALSE);
+   }
+
+   for(level=MAXLEVELS-1, n=0; level>=0; level--)
+   {
+      for(i=0; i<runs->nruns[level]; i++)
+         all[n++] = runs->runs[level][i];
+   }
+   return(MergeRuns(all, n, NULL, prefix, groups));
+}
+
+
+/************************************************************************/
+/*>void CloseRuns(RUNSET *runs)
+   ----------------------------
+   I/O:       RUNSET *runs    Run files - all are closed
+
+   19.10.26  Original   By: agent
+*/
+void CloseRuns(RUNSET *runs)
+{
+   int level, i;
+
+   for(level=0; level<MAXLEVELS; level++)
+   {
+      for(i=0; i<runs->nruns[level]; i++)
+         fclose(runs->runs[level][i]);
+      runs->nruns[level] = 0;
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL MergeRuns(FILE **runs, int nruns, FILE *to, char *prefix,
+                  GROUPTABLE *groups)
+   --------------------------------------------------------------
+   Input:     FILE       **runs    Run files (rewound here)
+              int        nruns     Number of runs
+              FILE       *to       Run file to merge into (or NULL)
+              char       *prefix   Group file prefix (if to is NULL)
+              GROUPTABLE *groups   Group table (if to is NULL)
+   Returns:   BOOL                 Success
+
+   k-way merge of sorted runs. Equal groups are taken from the earliest
+   run so input order is kept. Either writes a single merged run or, as
+   each group appears exactly once in the merged order, writes each
+   group file in turn.
+
+   19.10.26  Original   By: agent
+*/
+BOOL MergeRuns(FILE **runs, int nruns, FILE *to, char *prefix,
+               GROUPTABLE *groups)
+{
+   RUNHEAD *heads,
+           *h;
+   FILE    *fp = NULL;
+   char    filename[MAXBUFF];
+   int     i,
+           best,
+           current = (-1);
+   BOOL    ok = TRUE;
+
+   if(nruns == 0)
+      return(TRUE);
+   if((heads = (RUNHEAD *)malloc(nruns * sizeof(RUNHEAD))) == NULL)
+      return(FALSE);
+
+   for(i=0; i<nruns; i++)
+   {
+      rewind(runs[i]);
+      heads[i].fp = runs[i];
+      if(!ReadRunHead(&(heads[i])))
+         ok = FALSE;
+   }
+
+   while(ok)
+   {
+      for(i=0, best=(-1); i<nruns; i++)
+      {
+         if((heads[i].group >= 0) &&
+            ((best < 0) || (heads[i].group < heads[best].group)))
+            best = i;
+      }
+      if(best < 0)
+         break;
+      h = &(heads[best]);
+
+      if(to != NULL)
+      {
+         ok = (BOOL)((fwrite(&(h->group), sizeof(int), 1, to) == 1) &&
+                     (fwrite(&(h->len),   sizeof(int), 1, to) == 1) &&
+                     (fwrite(h->text, 1, h->len, to) == (size_t)h->len));
+      }
+      else
+      {
+         if(h->group != current)
+         {
+            if((fp != NULL) && fclose(fp))
+               ok = FALSE;
+            fp      = NULL;
+            current = h->group;
+            if(!GroupFilename(prefix, groups->groups[current].key,
+                              filename) ||
+               ((fp = fopen(filename, "w")) == NULL))
+            {
+               ok = FALSE;
+               break;
+            }
+         }
+         h->text[h->len] = '\0';
+         fprintf(fp, "%s\n", h->text);
+      }
+
+      if(!ReadRunHead(h))
+         ok = FALSE;
+   }
+
+   if((fp != NULL) && fclose(fp))
+      ok = FALSE;
+   free(heads);
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadRunHead(RUNHEAD *head)
+   -------------------------------
+   I/O:       RUNHEAD *head    Run - the next record is read into it
+   Returns:   BOOL             Success (TRUE at the end of the run, when
+                               group is set to -1)
+
+   19.10.26  Original   By: agent
+*/
+BOOL ReadRunHead(RUNHEAD *head)
+{
+   if(fread(&(head->group), sizeof(int), 1, head->fp) != 1)
+   {
+      head->group = (-1);
+      return((BOOL)!ferror(head->fp));
+   }
+   if((fread(&(head->len), sizeof(int), 1, head->fp) != 1) ||
+      (head->len < 0) || (head->len >= MAXBUFF) ||
+      (fread(head->text, 1, head->len, head->fp) != (size_t)head->len))
+   {
+      head->group = (-1);
+      return(FALSE);
+   }
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL GroupFilename(char *prefix, char *key, char *filename)
+   -----------------------------------------------------------
+   Input:     char   *prefix    Output filename prefix
+              char   *key       Group key
+   Output:    char   *filename  prefix.key (MAXBUFF long)
+   Returns:   BOOL              Success (FALSE if too long)
+
+   A '/' in a key is written as %2F and so that this can't clash with a
+   key that contains those characters, '%' itself is written as %25.
+   Distinct keys therefore always give distinct files.
+
+   19.10.26  Original (split from PrintGroupData())   By: agent
+   19.10.26  Escapes '/' and '%' rather than mapping '/' to '_'
+             By: agent
+*/
+BOOL GroupFilename(char *prefix, char *key, char *filename)
+{
+   char *chp;
+   int  len;
+   
+   for(chp=key, len=0; *chp; chp++)
+      len += ((*chp == '/') || (*chp == '%')) ? 3 : 1;
+   if(strlen(prefix) + len + 2 > MAXBUFF)
+      return(FALSE);
+
+   sprintf(filename, "%s.", prefix);
+   for(chp=filename+strlen(filename); *key; key++)
+   {
+      if(*key == '/')
+      {
+         strcpy(chp, "%2F");
+         chp += 3;
+      }
+      else if(*key == '%')
+      {
+         strcpy(chp, "%25");
+         chp += 3;
+      }
+      else
+      {
+         *(chp++) = *key;
+      }
+   }
+   *chp = '\0';
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void SeedReplicates(UINT32 *states, int nreps, unsigned long seed)
+   -----------------------------------------------------------------
+   Input:     int           nreps    Number of replicates
+              unsigned long seed     Seed
+   Output:    UINT32        *states  4*nreps random number states
+
+   Gives each replicate its own random number stream. states holds four
+   arrays of nreps words: element k of each is word 0-3 of the
+   xoshiro128** state for replicate k. Replicate 0 instead uses the
+   xorshift32 generator of RandomNumber(), seeded as SeedRandom()
+   would, with its state in states[0].
+
+   The xoshiro128** base state is set from the seed and replicate k
+   (k >= 1) starts k-1 jumps of 2^64 steps along from it, so no two
+   replicates can share random numbers.
+
+   19.10.26  Original   By: agent
+   19.10.26  xoshiro128** streams split by jumps   By: agent
+*/
+void SeedReplicates(UINT32 *states, int nreps, unsigned long seed)
+{
+   UINT32 base[4];
+   int    j, k;
+
+   states[0] = (UINT32)ScrambleSeed(seed);
+   
+   for(j=0; j<4; j++)
+      base[j] = (UINT32)ScrambleSeed((seed + (j+1) * 0x632BE5ABUL) &
+                                     0xFFFFFFFFUL);
+   for(k=1; k<nreps; k++)
+   {
+      for(j=0; j<4; j++)
+         states[j*nreps + k] = base[j];
+      JumpXoshiro(base);
+   }
+}
+
+
+/************************************************************************/
+/*>void StepXoshiro(UINT32 *s)
+   ---------------------------
+   I/O:       UINT32 *s     xoshiro128** state (4 words)
+
+   Advances the state by one step. (The output, which does not affect
+   the state, is calculated in DrawReplicates().)
+
+   19.10.26  Original   By: agent
+*/
+void StepXoshiro(UINT32 *s)
+{
+   UINT32 t = s[1] << 9;
+
+   s[2] ^= s[0];
+   s[3] ^= s[1];
+   s[1] ^= s[2];
+   s[0] ^= s[3];
+   s[2] ^= t;
+   s[3]  = ROTL32(s[3], 11);
+}
+
+
+/************************************************************************/
+/*>void JumpXoshiro(UINT32 *s)
+   ---------------------------
+   I/O:       UINT32 *s     xoshiro128** state (4 words)
+
+   Advances the state by 2^64 steps, using the jump polynomial published
+   with the generator (Blackman and Vigna).
+
+   19.10.26  Original   By: agent
+*/
+void JumpXoshiro(UINT32 *s)
+{
+   static UINT32 jump[4] = {0x8764000bU, 0xf542d2d3U, 
+                            0x6fa035c3U, 0x77f2db5bU};
+   UINT32 t[4];
+   int    i, b;
+
+   t[0] = t[1] = t[2] = t[3] = 0;
+   for(i=0; i<4; i++)
+   {
+      for(b=0; b<32; b++)
+      {
+         if(jump[i] & ((UINT32)1 << b))
+         {
+            t[0] ^= s[0];
+            t[1] ^= s[1];
+            t[2] ^= s[2];
+            t[3] ^= s[3];
+         }
+         StepXoshiro(s);
+      }
+   }
+   s[0] = t[0];
+   s[1] = t[1];
+   s[2] = t[2];
+   s[3] = t[3];
+}
+
+
+/************************************************************************/
+/*>void DrawReplicates(UINT32 *states, int nreps, REAL p,
+                       unsigned char *flags)
+   -----------------------------------------------------
+   Input:     int           nreps    Number of replicates
+              REAL          p        Probability of keeping the record
+   I/O:       UINT32        *states  Replicate random number states
+                                     (see SeedReplicates())
+   Output:    unsigned char *flags   1 if kept in replicate k, else 0
+
+   Draws one random number from each replicate's stream and compares it
+   with p. Replicate 0 draws exactly what RandomNumber(1.0) would. The
+   other streams are independent, so the xoshiro128** step runs as a
+   simple loop over the four state arrays with no branches, which the
+   compiler can vectorize.
+
+   19.10.26  Original   By: agent
+   19.10.26  xoshiro128** streams for replicates 1 on   By: agent
+*/
+void DrawReplicates(UINT32 *states, int nreps, REAL p,
+                    unsigned char *flags)
+{
+   UINT32 *s0 = states,
+          *s1 = states + nreps,
+          *s2 = states + 2*nreps,
+          *s3 = states + 3*nreps,
+          x, 
+          t,
+          limit;
+   int    k;
+   
+   x  = states[0];
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   states[0] = x;
+   flags[0]  = (unsigned char)(p >= x/(REAL)0xFFFFFFFFUL);
+
+   /* p >= x/(2^32-1) as an integer compare, so the loop needs no
+      conversions to floating point
+   */
+   if(p >= (REAL)1.0)
+      limit = (UINT32)0xFFFFFFFFUL;
+   else if(p > (REAL)0.0)
+      limit = (UINT32)(p * (REAL)0xFFFFFFFFUL);
+   else
+      limit = 0;
+   
+   for(k=1; k<nreps; k++)
+   {
+      x      = s1[k] * 5;
+      x      = ROTL32(x, 7) * 9;
+      t      = s1[k] << 9;
+      s2[k] ^= s0[k];
+      s3[k] ^= s1[k];
+      s1[k] ^= s2[k];
+      s0[k] ^= s3[k];
+      s2[k] ^= t;
+      s3[k]  = ROTL32(s3[k], 11);
+      flags[k] = (unsigned char)(x <= limit);
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL ReplicateData(FILE *in, FILE *out, char *prefix, int nreps,
+                      unsigned long seed, int valCol, int keyCol,
+                      GROUPTABLE *groups, REAL targetMean,
+                      REAL targetSD)
+   ---------------------------------------------------------------
+   Input:     FILE       *in         Input file
+              FILE       *out        Output file for the bitsets
+              char       *prefix     Prefix for per-replicate row
+                                     number files (or blank string)
+              int        nreps       Number of replicates
+              unsigned long seed     Random number seed
+              int        valCol      Column containing the value
+              int        keyCol      Column containing the key (or 0)
+              GROUPTABLE *groups     Group table (or NULL)
+              REAL       targetMean  Target mean
+              REAL       targetSD    Target standard deviation
+   Returns:   BOOL                   Success
+
+   Draws nreps independent samples in one pass. Each record is parsed
+   and its p calculated once; the replicates then cost one random
+   number each (DrawReplicates()). The input is streamed.
+
+   Without a prefix a line is written to out for every input record
+   holding the membership bitset as (nreps+3)/4 hex digits. The first
+   digit holds replicates 0-3, with replicate 0 as its high bit, and so
+   on. With a prefix, the (zero-based) row numbers kept in replicate k
+   are written one per line to prefix.k
+
+   19.10.26  Original   By: agent
+*/
+BOOL ReplicateData(FILE *in, FILE *out, char *prefix, int nreps,
+                   unsigned long seed, int valCol, int keyCol,
+                   GROUPTABLE *groups, REAL targetMean, REAL targetSD)
+{
+   static char   hex[] = "0123456789abcdef";
+   REALLIST      rec;
+   UINT32        *states = NULL;
+   unsigned char *flags  = NULL;
+   FILE          **repFiles = NULL;
+   char          buffer[MAXBUFF],
+                 filename[MAXBUFF+16],
+                 *line = NULL;
+   REAL          mean, 
+                 sd,
+                 p;
+   long          row;
+   int           k,
+                 nopen = 0;
+   BOOL          ok = TRUE;
+
+   /* Flags are padded to a whole number of hex digits                  */
+   states = (UINT32 *)malloc(4 * nreps * sizeof(UINT32));
+   flags  = (unsigned char *)calloc(nreps+3, sizeof(unsigned char));
+   line   = (char *)malloc((nreps+3)/4 + 1);
+   if((states == NULL) || (flags == NULL) || (line == NULL))
+      ok = FALSE;
+
+   if(ok && prefix[0])
+   {
+      if((repFiles = (FILE **)malloc(nreps * sizeof(FILE *)))==NULL)
+         ok = FALSE;
+      for(k=0; ok && k<nreps; k++)
+      {
+         sprintf(filename, "%s.%d", prefix, k);
+         if((repFiles[k] = fopen(filename, "w"))==NULL)
+            ok = FALSE;
+         else
+            nopen++;
+      }
+   }
+
+   if(ok)
+   {
+      SeedReplicates(states, nreps, seed);
+      line[(nreps+3)/4] = '\0';
+   }
+   
+   for(row=0; ok && fgets(buffer, MAXBUFF, in); row++)
+   {
+      TERMINATE(buffer);
+      if(!ParseRecord(buffer, &rec, valCol, keyCol, groups,
+                      targetMean, targetSD))
+      {
+         ok = FALSE;
+         break;
+      }
+
+      GetTarget(&rec, targetMean, targetSD, groups, &mean, &sd);
+      p = CalcProbability(ABS(((rec.value - mean)/sd)));
+      DrawReplicates(states, nreps, p, flags);
+
+      if(repFiles != NULL)
+      {
+         for(k=0; k<nreps; k++)
+         {
+            if(flags[k])
+               fprintf(repFiles[k], "%ld\n", row);
+         }
+      }
+      else
+      {
+         for(k=0; k<nreps; k+=4)
+         {
+            line[k/4] = hex[(flags[k]   << 3) | (flags[k+1] << 2) |
+                            (flags[k+2] << 1) |  flags[k+3]];
+         }
+         fprintf(out, "%s\n", line);
+      }
+   }
+   if(ferror(in))
+      ok = FALSE;
+
+   for(k=0; k<nopen; k++)
+   {
+      if(fclose(repFiles[k]))
+         ok = FALSE;
+   }
+   if(fflush(out))
+      ok = FALSE;
+   
+   if(states   != NULL) free(states);
+   if(flags    != NULL) free(flags);
+   if(line     != NULL) free(line);
+   if(repFiles != NULL) free(repFiles);
+   
+   return(ok);
+}
@@ -0,0 +1,124 @@
+/* Online statistics of the accepted values, gathered in the same pass
+   as the selection so that the output need not be re-read to check it.
+
+   Each accumulator holds Welford-style running moments (mean, M2, M3)
+   of the accepted values and a sketch of their probability integral
+   transform: u = F(x), where F is the CDF of the requested target. If
+   the output follows the target, u is uniform on [0,1]. u is counted
+   into STATS_NBINS equal bins, so the Kolmogorov-Smirnov distance
+
+      D = max |F_n(u) - u|
+
+   is found exactly at the bin edges and to within 1/STATS_NBINS in
+   between. Working in u rather than x means the same sketch serves a
+   single target, per-group targets (which can then be pooled) and the
+   multivariate chi-squared case.
+
+   Accumulators are independent and can be combined with MergeStats()
+   (moments by the pairwise formulae of Chan et al., histograms by
+   adding counts), so partial results from groups or blocks of input
+   merge into the same totals as one pass over everything.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "erf.h"
+#include "stats.h"
+
+
+void InitStats(STATS *s)
+{
+   memset(s, 0, sizeof(STATS));
+   s->mean = s->m2 = s->m3 = 0.0;
+}
+
+
+/* Adds an accepted value, x, whose target CDF value is u
+ */
+void AddStats(STATS *s, double x, double u)
+{
+   double n1, delta, dn, term;
+   int    bin;
+
+   n1    = (double)s->n;
+   s->n++;
+   delta = x - s->mean;
+   dn    = delta / (double)s->n;
+   term  = delta * dn * n1;
+   s->mean += dn;
+   s->m3   += term * dn * ((double)s->n - 2.0) - 3.0 * dn * s->m2;
+   s->m2   += term;
+
+   bin = (int)(u * STATS_NBINS);
+   if(bin < 0)            bin = 0;
+   if(bin >= STATS_NBINS) bin = STATS_NBINS - 1;
+   s->hist[bin]++;
+}
+
+
+void MergeStats(STATS *to, STATS *from)
+{
+   double na, nb, n, delta;
+   int    i;
+
+   to->seen += from->seen;
+   if(from->n == 0)
+      return;
+
+   na    = (double)to->n;
+   nb    = (double)from->n;
+   n     = na + nb;
+   delta = from->mean - to->mean;
+
+   to->m3 += from->m3 + 
+             delta * delta * delta * na * nb * (na - nb) / (n * n) +
+             3.0 * delta * (na * from->m2 - nb * to->m2) / n;
+   to->m2 += from->m2 + delta * delta * na * nb / n;
+   to->mean += delta * nb / n;
+   to->n    += from->n;
+
+   for(i=0; i<STATS_NBINS; i++)
+      to->hist[i] += from->hist[i];
+}
+
+
+double StatsSD(STATS *s)
+{
+   return (s->n > 1) ? sqrt(s->m2 / (double)(s->n - 1)) : 0.0;
+}
+
+
+double StatsSkew(STATS *s)
+{
+   return (s->m2 > 0.0) ? 
+      sqrt((double)s->n) * s->m3 / pow(s->m2, 1.5) : 0.0;
+}
+
+
+double StatsKS(STATS *s)
+{
+   unsigned long cum = 0;
+   double        d, dmax = 0.0, lo, hi;
+   int           i;
+
+   if(s->n == 0)
+      return 1.0;
+
+   for(i=0; i<STATS_NBINS; i++)
+   {
+      /* The empirical CDF jumps within the bin, so check both edges  */
+      lo   = (double)cum / (double)s->n - (double)i / STATS_NBINS;
+      cum += s->hist[i];
+      hi   = (double)cum / (double)s->n - (double)(i+1) / STATS_NBINS;
+      d    = fabs(lo) > fabs(hi) ? fabs(lo) : fabs(hi);
+      if(d > dmax)
+         dmax = d;
+   }
+   return dmax;
+}
+
+
+double NormalCDF(double z)
+{
+   return 0.5 * erfcc(-z / sqrt(2.0));
+}
@@ -0,0 +1,25 @@
+/* Mergeable output quality statistics - see stats.c
+ */
+#ifndef _STATS_H
+#define _STATS_H
+
+#define STATS_NBINS 1024
+
+typedef struct
+{
+   unsigned long seen,               /* Records considered              */
+                 n,                  /* Records accepted                */
+                 hist[STATS_NBINS];  /* Accepted target CDF values      */
+   double        mean,               /* Welford running moments         */
+                 m2,
+                 m3;
+}  STATS;
+
+void   InitStats(STATS *s);
+void   AddStats(STATS *s, double x, double u);
+void   MergeStats(STATS *to, STATS *from);
+double StatsSD(STATS *s);
+double StatsSkew(STATS *s);
+double StatsKS(STATS *s);
+double NormalCDF(double z);
+#endif